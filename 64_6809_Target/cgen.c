@@ -1,7 +1,13 @@
+#ifdef FUNCCACHE
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
 #include "defs.h"
 #define extern_
 #include "data.h"
 #undef extern_
+#include "cg.h"
 #include "gen.h"
 #include "misc.h"
 #include "sym.h"
@@ -47,9 +53,233 @@ void allocateGlobals(void) {
       genglobsym(sym);
       sym=sym->next;
   }
-  freeSymtable();		// Clear the symbol table
+  trimSymtable();		// Trim the symbol table
 }
  
+#ifdef FUNCCACHE
+// On the host, wcc can give us a cache directory. We keep the
+// code for each function there, named by a hash of its AST nodes,
+// the symbols they use and of us. The labels which the function
+// made and its line comments are numbered from the first ones in
+// the cache, so that a function which has only moved is found again.
+static char *Cachedir= NULL;		// Cache directory, or NULL
+static unsigned long long Genhash;	// Hash of us
+static int Lablo, Labhi;		// Labels the function made
+static int Linebase;			// The function's first line number
+#define LINECOMMENT ";\t\t\t\t\tline "
+
+// Start the hash with our name and the size
+// and modification time of our binary
+static void hashprogram(char *name) {
+  struct stat sb;
+  char buf[100];
+  char *s;
+
+  if ((s= strrchr(name, '/')) != NULL)
+    name= s + 1;
+  Genhash= fnvhash(FNVINIT, name, strlen(name) + 1);
+  if (stat("/proc/self/exe", &sb) == 0) {
+    sprintf(buf, "%lld %lld", (long long) sb.st_size, (long long) sb.st_mtime);
+    Genhash= fnvhash(Genhash, buf, strlen(buf));
+  }
+}
+
+// If s is the start of a label which the function made,
+// return the label's number, else -1. The QBE names of
+// locals start with a '%', so skip those.
+static int funclabel(char *line, char *s) {
+  char *t;
+  int n;
+
+  if (s[0] != 'L' || !isdigit(s[1]))
+    return(-1);
+  if (s > line && (isalnum(s[-1]) || s[-1] == '_' || s[-1] == '%'))
+    return(-1);
+  for (t= s + 1; isdigit(*t); t++);
+  if (isalnum(*t) || *t == '_')
+    return(-1);
+  n= atoi(s + 1);
+  if (n < Lablo || n >= Labhi)
+    return(-1);
+  return(n);
+}
+
+// Output the line from s up to e with its labels
+// and line comment numbered from the first ones
+static void putnorm(char *s, char *e, FILE *out) {
+  char *line= s;
+  int n;
+
+  if (Linebase != 0 && !strncmp(s, LINECOMMENT, strlen(LINECOMMENT))) {
+    fprintf(out, LINECOMMENT "@%d\n", atoi(s + strlen(LINECOMMENT)) - Linebase);
+    return;
+  }
+  while (s < e) {
+    if ((n= funclabel(line, s)) != -1) {
+      fprintf(out, "L@%d", n - Lablo);
+      for (s++; isdigit(*s); s++);
+      continue;
+    }
+    putc(*s++, out);
+  }
+}
+
+// Undo putnorm() on a line from the cache. Keep Line
+// up to date, as genAST() would have
+static void putdenorm(char *s, FILE *out) {
+  if (!strncmp(s, LINECOMMENT "@", strlen(LINECOMMENT) + 1)) {
+    Line= atoi(s + strlen(LINECOMMENT) + 1) + Linebase;
+    fprintf(out, LINECOMMENT "%d\n", Line);
+    return;
+  }
+  while (*s) {
+    if (s[0] == 'L' && s[1] == '@') {
+      fprintf(out, "L%d", atoi(s + 2) + Lablo);
+      for (s += 2; isdigit(*s); s++);
+      continue;
+    }
+    putc(*s++, out);
+  }
+}
+
+// Output a function's code from the cache file fp.
+// Return 1 if we did, 0 if the entry is no good.
+static int fetchfunc(FILE *fp) {
+  char *line= NULL, *str;
+  size_t linelen= 0;
+  int count, label, len;
+  FILE *out;
+
+  if (getline(&line, &linelen, fp) == -1 ||
+      sscanf(line, "F %d", &count) != 1) {
+    free(line);
+    return(0);
+  }
+  Labhi= Lablo + count;
+  setlabelid(Labhi);
+
+  // Make the string literals again for targets which output
+  // them later. Any code output for them now is already in
+  // the cached code, so throw it away
+  out= Outfile;
+  Outfile= fopen("/dev/null", "w");
+  if (Outfile == NULL)
+    fatal("Can't open /dev/null");
+  while (getline(&line, &linelen, fp) != -1) {
+    if (sscanf(line, "S %d %d", &label, &len) != 2)
+      break;
+    str= (char *)malloc(len + 1);
+    if (str == NULL)
+      fatal("Unable to malloc in fetchfunc()");
+    if (fread(str, 1, len + 1, fp) != len + 1)
+      fatal("Short string literal in the function cache");
+    str[len]= 0;
+    cglitseg();
+    cgglobstr(Lablo + label, str);
+    cgtextseg();
+    free(str);
+  }
+  fclose(Outfile);
+  Outfile= out;
+
+  // Now the code after the T line
+  while (getline(&line, &linelen, fp) != -1)
+    putdenorm(line, Outfile);
+  free(line);
+  return(1);
+}
+
+// Write the function's code in buf and the string
+// literals logged in strbuf to the cache as name
+static void storefunc(char *name, char *buf, char *strbuf) {
+  char *tmpname, *s, *e;
+  int label, len;
+  FILE *fp;
+
+  // Write the entry to a temporary file first,
+  // so that other compiles never see a partial one
+  tmpname= (char *)malloc(strlen(name) + 20);
+  if (tmpname == NULL)
+    fatal("Unable to malloc in storefunc()");
+  sprintf(tmpname, "%s.%d", name, getpid());
+  if ((fp= fopen(tmpname, "w")) == NULL) {
+    free(tmpname);
+    return;
+  }
+
+  fprintf(fp, "F %d\n", Labhi - Lablo);
+  for (s= strbuf; sscanf(s, "S %d %d", &label, &len) == 2; s= e + len + 2) {
+    e= strchr(s, '\n');
+    fprintf(fp, "S %d %d\n", label - Lablo, len);
+    fwrite(e + 1, 1, len + 1, fp);
+  }
+  fputs("T\n", fp);
+  for (s= buf; *s; s= e) {
+    e= strchr(s, '\n');
+    e= (e == NULL) ? s + strlen(s) : e + 1;
+    putnorm(s, e, fp);
+  }
+
+  if (fclose(fp) != 0 || rename(tmpname, name) != 0)
+    unlink(tmpname);
+  free(tmpname);
+}
+
+// Generate the code for the function whose top node we
+// have just loaded, or copy it from the cache. firstlabel
+// is the first label made when the node was loaded.
+static void gencachedfunc(struct ASTnode *node, int firstlabel) {
+  char *name, *buf, *strbuf;
+  size_t len, strsize;
+  FILE *fp, *out;
+
+  // Output what genAST() would before the function's code:
+  // its first line comment and a switch to the text segment.
+  // They depend on the code before it, so they aren't cached
+  if (node->linenum != 0 && Line != node->linenum) {
+    Line= node->linenum;
+    cglinenum(Line);
+  }
+  cgtextseg();
+  Lablo= firstlabel;
+
+  name= (char *)malloc(strlen(Cachedir) + 40);
+  if (name == NULL)
+    fatal("Unable to malloc in gencachedfunc()");
+  sprintf(name, "%s/%016llx.gs", Cachedir, hashFuncnodes(Genhash, &Linebase));
+
+  if ((fp= fopen(name, "r")) != NULL) {
+    if (fetchfunc(fp)) {
+      fclose(fp);
+      utime(name, NULL);
+      free(name);
+      return;
+    }
+    fclose(fp);
+  }
+
+  // Not in the cache. Generate the code and
+  // log the string literals into memory
+  out= Outfile;
+  Outfile= open_memstream(&buf, &len);
+  Strlog= open_memstream(&strbuf, &strsize);
+  if (Outfile == NULL || Strlog == NULL)
+    fatal("Unable to open_memstream in gencachedfunc()");
+  genAST(node, NOLABEL, NOLABEL, NOLABEL, 0);
+  fclose(Outfile);
+  fclose(Strlog);
+  Strlog= NULL;
+  Outfile= out;
+  Labhi= getlabelid();
+
+  fwrite(buf, 1, len, Outfile);
+  storefunc(name, buf, strbuf);
+  free(buf);
+  free(strbuf);
+  free(name);
+}
+#endif
+
 
 // Open the symbol table file and AST file
 // Loop:
@@ -58,53 +288,113 @@ void allocateGlobals(void) {
 //  Free the in-memory symbol tables
 int main(int argc, char **argv) {
   struct ASTnode *node;
+#ifdef FUNCCACHE
+  int firstlabel;
 
-  if (argc !=4) {
-    fprintf(stderr, "Usage: %s symfile astfile idxfile\n", argv[0]);
+  if (argc <4 || argc >6) {
+    fprintf(stderr,
+	"Usage: %s symfile astfile idxfile <symidxfile> <cachedir>\n",
+								argv[0]);
     exit(1);
   }
 
+  // Cache each function's code if we have a cache directory
+  if (argc==6) {
+    Cachedir= argv[5];
+    hashprogram(argv[0]);
+  }
+#else
+
+  if (argc <4 || argc >5) {
+    fprintf(stderr, "Usage: %s symfile astfile idxfile <symidxfile>\n",
+								argv[0]);
+    exit(1);
+  }
+#endif
+
   // Open the symbol table file
   Symfile= fopen(argv[1], "r");
   if (Symfile == NULL) {
     fprintf(stderr, "Can't open %s\n", argv[1]); exit(1);
   }
+  if (checkSymfile() == 0) {
+    fprintf(stderr, "%s is not a version %d symbol file\n",
+						argv[1], SYMVERSION);
+    exit(1);
+  }
 
   // Open the AST file
   Infile= fopen(argv[2], "r");
   if (Infile == NULL) {
     fprintf(stderr, "Can't open %s\n", argv[2]); exit(1);
   }
+  if (checkASTfile() == 0) {
+    fprintf(stderr, "%s is not a version %d AST file\n",
+						argv[2], ASTVERSION);
+    exit(1);
+  }
 
-  // Open the AST index offset file for read/writing
-  Idxfile= fopen(argv[3], "w+");
+  // Open the AST index offset file which the parser made
+  Idxfile= fopen(argv[3], "r");
   if (Idxfile == NULL) {
     fprintf(stderr, "Can't open %s\n", argv[3]); exit(1);
   }
 
+  // Open the symbol index file if we have one.
+  // Without it, we search the symbol file from the start
+  if (argc>=5) {
+    Symidxfile= fopen(argv[4], "r");
+    if (Symidxfile == NULL) {
+      fprintf(stderr, "Can't open %s\n", argv[4]); exit(1);
+    }
+    loadSymidx();
+  }
+
   // We write assembly to stdout
   Outfile=stdout;
 
-  mkASTidxfile();		// Build the AST index offset file
+#ifdef MMAPFILES
+  // Read the symbol and AST files through memory mappings
+  mapfile(Symfile);
+  mapfile(Infile);
+  mapfile(Idxfile);
+  if (Symidxfile != NULL)
+    mapfile(Symidxfile);
+#endif
+
+  loadASTidx();			// Load the function offsets
   freeSymtable();		// Clear the symbol table
   genpreamble();		// Output the preamble
   allocateGlobals();		// Allocate global variables
 
   while (1) {
+#ifdef FUNCCACHE
+    firstlabel= getlabelid();
+#endif
     // Read the next function's top node in from file
     node= loadASTnode(0, 1);
     if (node==NULL) break;
 
+#ifdef FUNCCACHE
+    // Use or fill the function cache if we have one
+    if (Cachedir != NULL)
+      gencachedfunc(node, firstlabel);
+    else
+#endif
     // Generate the assembly code for the tree
     genAST(node, NOLABEL, NOLABEL, NOLABEL, 0);
 
-    // Free the symbols in the in-memory symbol tables.
-    // Also free the AST node we loaded in
-    freeSymtable();
+    // Trim the in-memory symbol tables down to size,
+    // keeping the most recently used symbols for the
+    // next function. Also free the AST node we loaded in
+    trimSymtable();
     freeASTnode(node);
   }
 
   genpostamble();               // Output the postamble
+#ifdef ASTSTATS
+  printASTstats();		// Show how the AST nodes were found
+#endif
   freeSymtable();
   fclose(Infile);
   fclose(Symfile);
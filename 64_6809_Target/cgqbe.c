@@ -168,6 +168,11 @@ void cgfuncpreamble(struct symtable *sym) {
   }
 
   used_switch = 0;		// We haven't output the switch handling code yet
+
+  // QBE temporaries are local to a function, so number them
+  // from the start in each one. The code for a function then
+  // doesn't depend on the ones before it
+  nexttemp = 0;
 }
 
 // Print out a function postamble
@@ -7,6 +7,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#ifdef FUNCCACHE
+#include <utime.h>
+#endif
 
 int rpn_eval(char *expr, char **vars);
 
@@ -517,28 +521,307 @@ struct lnode *opt(struct lnode *r) {
   return r->l_next;
 }
 
+/* optimise - run the rules over the lines between head and tail */
+void optimise(struct lnode *head, struct lnode *tail) {
+  struct lnode *p;
+  int pass;
+
+  pass = 0;
+  do {
+    ++pass;
+    if (debug)
+      fprintf(stderr, "\n--- pass %d ---\n", pass);
+    global_again = 0;
+    for (p = head->l_next; p != tail; p = opt(p));
+  } while (global_again && pass < MAX_PASS);
+
+  if (global_again) {
+    fprintf(stderr, "error: maximum of %d passes exceeded\n", MAX_PASS);
+    error("       check for recursive substitutions");
+  }
+}
+
+#ifdef FUNCCACHE
+/*
+ * On the host, wcc can give us a cache directory with -C. Each 6809
+ * function ends with an rts, and when no rule can match across one,
+ * we can optimise each function on its own. We keep the optimised
+ * lines in the cache, named by a hash of the rules and of the lines
+ * that we were given. The labels which a function defines and its
+ * line comments are numbered from the first ones in the hash and in
+ * the cache, so a function which has only moved is found again.
+ */
+char *cachedir = NULL;			/* cache directory, or NULL */
+unsigned long long rulehash;		/* hash of us and the rules */
+int lablo, labhi;			/* range of labels defined */
+char *labdef = NULL;			/* which labels are defined */
+int linebase;				/* first line comment number */
+#define LINECOMMENT ";\t\t\t\t\tline "
+
+/* fnvhash - add len bytes to a 64-bit FNV-1a hash */
+unsigned long long fnvhash(unsigned long long hash, char *buf, int len) {
+  int i;
+
+  for (i = 0; i < len; i++) {
+    hash ^= (unsigned char) buf[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+/* hashrules - hash this program and the rules file */
+void hashrules(FILE * fp) {
+  struct stat sb;
+  char buf[4096];
+  int n;
+
+  rulehash = 14695981039346656037ULL;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+    rulehash = fnvhash(rulehash, buf, n);
+  rewind(fp);
+  if (stat("/proc/self/exe", &sb) == 0) {
+    sprintf(buf, "%lld %lld", (long long) sb.st_size, (long long) sb.st_mtime);
+    rulehash = fnvhash(rulehash, buf, strlen(buf));
+  }
+}
+
+/* cancache - return 1 if the rules can't match across an rts,
+   number any new labels or depend on the order of the functions */
+int cancache(void) {
+  struct onode *o;
+  struct lnode *p;
+  char *vars[10], *s;
+  int i;
+
+  for (o = opts; o; o = o->o_next) {
+    for (p = o->o_old; p; p = p->l_prev) {
+      if (p->l_text[0] == '%')
+	return 0;
+      for (i = 0; i < 10; i++)
+	vars[i] = 0;
+      if (match("\trts\n", p->l_text, vars))
+	return 0;
+    }
+    for (p = o->o_new; p; p = p->l_next)
+      for (s = p->l_text; (s = strchr(s, '%')) != NULL; s += 2)
+	if (s[1] != '%' && !isdigit(s[1]))
+	  return 0;
+  }
+  return 1;
+}
+
+/* islabel - return the number if s is the start of a label, else -1 */
+int islabel(char *line, char *s) {
+  if (*s != 'L' || !isdigit(s[1]))
+    return -1;
+  if (s > line && (isalnum(s[-1]) || s[-1] == '_'))
+    return -1;
+  return atoi(s + 1);
+}
+
+/* notelabels - find the labels and the first line
+   comment in the lines between head and tail */
+void notelabels(struct lnode *head, struct lnode *tail) {
+  struct lnode *p;
+  int n;
+
+  lablo = labhi = -1;
+  linebase = -1;
+  for (p = head->l_next; p != tail; p = p->l_next) {
+    if ((n = islabel(p->l_text, p->l_text)) != -1) {
+      if (lablo == -1 || n < lablo)
+	lablo = n;
+      if (n > labhi)
+	labhi = n;
+    }
+    if (linebase == -1 && !strncmp(p->l_text, LINECOMMENT, strlen(LINECOMMENT)))
+      linebase = atoi(p->l_text + strlen(LINECOMMENT));
+  }
+
+  free(labdef);
+  labdef = NULL;
+  if (lablo == -1)
+    return;
+  labdef = (char *) calloc(labhi - lablo + 1, 1);
+  if (labdef == NULL)
+    error("notelabels: out of memory\n");
+  for (p = head->l_next; p != tail; p = p->l_next)
+    if ((n = islabel(p->l_text, p->l_text)) != -1)
+      labdef[n - lablo] = 1;
+}
+
+/* putnorm - output a line with its defined labels
+   and line comment numbered from the first ones */
+void putnorm(char *line, FILE * out) {
+  char *s;
+  int n;
+
+  if (linebase != -1 && !strncmp(line, LINECOMMENT, strlen(LINECOMMENT))) {
+    fprintf(out, LINECOMMENT "@%d\n", atoi(line + strlen(LINECOMMENT)) - linebase);
+    return;
+  }
+  for (s = line; *s;) {
+    n = islabel(line, s);
+    if (n >= lablo && n <= labhi && lablo != -1 && labdef[n - lablo]) {
+      fprintf(out, "L@%d", n - lablo);
+      for (s++; isdigit(*s); s++);
+      continue;
+    }
+    putc(*s++, out);
+  }
+}
+
+/* putdenorm - undo putnorm() on a line from the cache */
+void putdenorm(char *line, FILE * out) {
+  char *s;
+
+  if (!strncmp(line, LINECOMMENT "@", strlen(LINECOMMENT) + 1)) {
+    fprintf(out, LINECOMMENT "%d\n", atoi(line + strlen(LINECOMMENT) + 1) + linebase);
+    return;
+  }
+  for (s = line; *s;) {
+    if (s[0] == 'L' && s[1] == '@') {
+      fprintf(out, "L%d", atoi(s + 2) + lablo);
+      for (s += 2; isdigit(*s); s++);
+      continue;
+    }
+    putc(*s++, out);
+  }
+}
+
+/* optfunc - optimise the lines of one function between head
+   and tail, or find them in the cache, and output them */
+void optfunc(struct lnode *head, struct lnode *tail, FILE * out) {
+  char lin[2 * MAXLINE], *buf, *name, *tmpname;
+  unsigned long long hash;
+  struct lnode *p;
+  size_t len;
+  FILE *fp;
+
+  notelabels(head, tail);
+  fp = open_memstream(&buf, &len);
+  if (fp == NULL)
+    error("optfunc: out of memory\n");
+  for (p = head->l_next; p != tail; p = p->l_next)
+    putnorm(p->l_text, fp);
+  fclose(fp);
+  hash = fnvhash(rulehash, buf, len);
+  free(buf);
+
+  name = (char *) malloc(strlen(cachedir) + 40);
+  tmpname = (char *) malloc(strlen(cachedir) + 60);
+  if (name == NULL || tmpname == NULL)
+    error("optfunc: out of memory\n");
+  sprintf(name, "%s/%016llx.ps", cachedir, hash);
+
+  if ((fp = fopen(name, "r")) != NULL) {
+    while (fgets(lin, sizeof(lin), fp) != NULL)
+      putdenorm(lin, out);
+    fclose(fp);
+    utime(name, NULL);
+  } else {
+    optimise(head, tail);
+    printlines(head->l_next, tail, out);
+
+    /* Write the entry to a temporary file first,
+       so that other compiles never see a partial one */
+    sprintf(tmpname, "%s.%d", name, getpid());
+    if ((fp = fopen(tmpname, "w")) != NULL) {
+      for (p = head->l_next; p != tail; p = p->l_next)
+	putnorm(p->l_text, fp);
+      if (fclose(fp) != 0 || rename(tmpname, name) != 0)
+	unlink(tmpname);
+    }
+  }
+  free(name);
+  free(tmpname);
+}
+
+/* optfuncs - optimise the lines between head
+   and tail one function at a time */
+void optfuncs(struct lnode *head, struct lnode *tail, FILE * out) {
+  struct lnode fhead, ftail, *first, *last, *next;
+
+  fhead.l_text = ftail.l_text = "";
+  fhead.l_prev = ftail.l_next = NULL;
+  for (first = head->l_next; first != tail; first = next) {
+    for (last = first; last->l_next != tail; last = last->l_next)
+      if (!strcmp(last->l_text, "\trts\n"))
+	break;
+    next = last->l_next;
+    connect(&fhead, first);
+    connect(last, &ftail);
+    optfunc(&fhead, &ftail, out);
+  }
+}
+#endif
+
+/*
+ * When we are linked into wcc, its compile server reads the rules
+ * in once with loadrules() and each cpeep that it starts inherits
+ * them. We note the rules file's name and modification time so
+ * that we read it again if it has changed.
+ */
+char *rulesname = NULL;			/* rules file we have read in */
+time_t rulestime;			/* and its modification time */
+
+/* loadrules - read in the rules from the named file unless
+   we have them already. Return the file, or NULL if we can't
+   open it */
+FILE *loadrules(char *name) {
+  struct stat sb;
+  FILE *fp;
+
+  if ((fp = fopen(name, "r")) == NULL)
+    return (NULL);
+  if (fstat(fileno(fp), &sb) == -1)
+    sb.st_mtime = 0;
+  if (rulesname != NULL && !strcmp(rulesname, name) &&
+      sb.st_mtime == rulestime && sb.st_mtime != 0)
+    return (fp);
+
+  opts = NULL;
+  init(fp);
+  rewind(fp);
+  free(rulesname);
+  rulesname = strdup(name);
+  rulestime = sb.st_mtime;
+  return (fp);
+}
+
 /* #define _TESTING */
 
 void usage(char *name) {
+#ifdef FUNCCACHE
+  fprintf(stderr, "Usage: %s [-D] [-C cachedir] [-o output] input rulesfile\n", name);
+#else
   fprintf(stderr, "Usage: %s [-D] [-o output] input rulesfile\n", name);
+#endif
   exit(1);
 }
 
 /* main - peephole optimizer */
 int main(int argc, char **argv) {
   FILE *fp, *infile, *outfile = stdout;
-  int pass, option;
-  struct lnode head, *p, tail;
+  int option;
+  struct lnode head, tail;
 
-  opts = NULL;
   activerule = NULL;
-  htab[0]= NULL;
 
   if (argc < 3)
     usage(argv[0]);
 
+#ifdef FUNCCACHE
+  while ((option = getopt(argc, argv, "C:Do:")) != -1) {
+#else
   while ((option = getopt(argc, argv, "Do:")) != -1) {
+#endif
     switch (option) {
+#ifdef FUNCCACHE
+    case 'C':
+      cachedir = optarg;
+      break;
+#endif
     case 'D':
       debug = 1;
       break;
@@ -560,30 +843,26 @@ int main(int argc, char **argv) {
     exit(1);
   }
   // Get the patterns file
-  if ((fp = fopen(argv[optind + 1], "r")) == NULL) {
+  if ((fp = loadrules(argv[optind + 1])) == NULL) {
     fprintf(stderr, "Can't open patterns file %s\n", argv[optind + 1]);
     exit(1);
   }
-  init(fp);
+#ifdef FUNCCACHE
+  if (cachedir != NULL)
+    hashrules(fp);
+#endif
 
   getlst(infile, "", &head, &tail);
 
   head.l_text = tail.l_text = "";
 
-  pass = 0;
-  do {
-    ++pass;
-    if (debug)
-      fprintf(stderr, "\n--- pass %d ---\n", pass);
-    global_again = 0;
-    for (p = head.l_next; p != &tail; p = opt(p));
-  } while (global_again && pass < MAX_PASS);
-
-  if (global_again) {
-    fprintf(stderr, "error: maximum of %d passes exceeded\n", MAX_PASS);
-    error("       check for recursive substitutions");
+#ifdef FUNCCACHE
+  if (cachedir != NULL && cancache()) {
+    optfuncs(&head, &tail, outfile);
+    exit(0);
   }
-
+#endif
+  optimise(&head, &tail);
   printlines(head.l_next, &tail, outfile);
   exit(0);
   return 1;			/* make compiler happy */
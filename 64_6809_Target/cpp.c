@@ -0,0 +1,1870 @@
+#include "defs.h"
+#include "data.h"
+#include "misc.h"
+#include "cpp.h"
+#if defined(SCANBUFSIZE) && defined(MMAPFILES)
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// The built-in C pre-processor
+// Copyright (c) 2024 Warren Toomey, GPL3
+
+// When the scanner is given a C file instead of pre-processed
+// input on stdin, it gets its characters from cppgetc(). We read
+// the file, strip the comments, obey the # directives and expand
+// the macros as we go, so the text goes from the source to the
+// tokens in one pass. The scanner is told of each change of file
+// and line number with setfileline(), just as a line marker from
+// an external cpp would. To keep the line numbers in step, every
+// newline in the source reaches the scanner, except those inside
+// a macro call which come out just after the macro's expansion.
+
+#define MAXINCDIRS 20		// Number of -I directories
+#define MAXIFDEPTH 40		// Depth of nested #if's
+#define MAXPARAMS 30		// Number of parameters to a macro
+#define NMACROHASH 64		// Buckets in the macro hash table
+#define CPPLINELEN 1024		// Length of a directive line
+
+// In a macro body, each use of a parameter is replaced by MPARAM
+// and the parameter's number plus one. A # before a parameter is
+// replaced by MSTRING, and ## with any space around it by MPASTE
+#define MPARAM 1
+#define MSTRING 2
+#define MPASTE 3
+
+// A macro definition
+struct macro {
+  char *name;			// Name of the macro
+  int nparams;			// Number of parameters, -1 if object-like
+  char *body;			// Replacement text
+  int busy;			// Being expanded, so don't expand it again
+  struct macro *next;		// Next macro in the hash bucket
+};
+
+// Each level of input is a source file or the text of a macro
+// expansion. We read from the top level and drop back to the
+// one below at its end.
+struct cppinput {
+  FILE *file;			// The file being read, or NULL
+  char *path;			// The file's path
+  char *name;			// Its name for the scanner, see #line
+  int line;			// Number of the line we are reading
+  int splices;			// Backslash-newlines not yet sent on
+  int ifbase;			// Depth of #if's when the file was opened
+  char *guard;			// Macro which may guard the whole file
+  int guardstate;		// How far we have seen the guard, see below
+  char *text;			// For a text level, the text
+  int pos;			// and the position in it
+  struct macro *macro;		// Macro being expanded, if any
+  int newlines;			// Newlines read inside the macro's call
+  int barrier;			// At the end of the text, return EOF
+  int back;			// Character put back, or 0
+#ifdef SCANBUFSIZE
+  char *buf;			// The file's block buffer or mapping
+  char *ptr;			// Next character in it
+  char *end;			// End of the characters in it
+  int mapped;			// Is the whole file mapped?
+#endif
+  struct cppinput *prev;	// The level below this one
+};
+
+// A file is guarded if it is all one #ifndef group. We skip any
+// later #include of it when the guard macro is defined
+#define G_START 0		// Nothing seen yet
+#define G_INSIDE 1		// Inside the #ifndef group
+#define G_CLOSED 2		// Seen the group's #endif
+#define G_NONE 3		// The file isn't guarded
+
+struct guardfile {
+  char *name;			// Name of a guarded file
+  char *guard;			// and its guard macro
+  struct guardfile *next;
+};
+
+// The state of each #if group
+#define IF_ACTIVE 0		// We are in the group which is true
+#define IF_WAIT 1		// No group has been true yet
+#define IF_DONE 2		// An earlier group was true
+#define IF_SKIP 3		// The enclosing group is false
+
+// A string which grows as characters are added to it
+struct cppbuf {
+  char *text;
+  int len;
+  int size;
+};
+
+static struct cppinput *Input;		// Top input level
+static struct cppinput *Curfile;	// Top level which is a file
+static struct macro *Macrohash[NMACROHASH];
+static struct guardfile *Guardhead;
+static char *Incdir[MAXINCDIRS];	// The -I directories
+static int Nincdirs = 0;
+static int Ifstate[MAXIFDEPTH];		// State of each #if group
+static int Ifdepth = 0;
+
+static char Outbuf[TEXTLEN + 1];	// Characters waiting to be sent
+static int Outpos = 0;
+static int Outlen = 0;
+static int Pendnl = 0;		// Newlines waiting to be sent
+static int Heldnl = 0;		// Blank lines held back, see cppgetc()
+static int Lastsent = '\n';	// Last character given to the scanner
+static int Bol = 1;		// At the beginning of a line in a file
+static int Inquote = 0;		// Quote character of a literal being sent
+static int Escaped = 0;		// Last literal character was a backslash
+static int Innumber = 0;	// Sending the rest of a number
+static int Lastc = '\n';	// Last character sent
+static int Checkpaste = 0;	// Started or ended a macro expansion
+static char Dline[CPPLINELEN];	// Text of the current directive
+static char *Dp;		// Position in Dline
+static char *Ep;		// Position in an #if expression
+static int Dirline = 0;		// Line of the directive being obeyed, or 0
+
+static int nextexp(void);
+
+// The scanner's line number only counts the newlines which we
+// have sent it, and so it can be behind the line we are reading.
+// Point our error messages at that line, or at the line of the
+// directive which we are obeying
+static void cppline(void) {
+  if (Curfile == NULL)
+    return;
+  if (Dirline != 0)
+    Line = Dirline;
+  else
+    Line = Curfile->line;
+  Infilename = Curfile->name;
+}
+
+static void cppfatal(char *s) {
+  cppline();
+  fatal(s);
+}
+
+static void cppfatals(char *s1, char *s2) {
+  cppline();
+  fatals(s1, s2);
+}
+
+// Make a new, empty, growable string
+static struct cppbuf *newbuf(void) {
+  struct cppbuf *b;
+
+  b = (struct cppbuf *) malloc(sizeof(struct cppbuf));
+  if (b == NULL)
+    cppfatal("Unable to malloc a cpp buffer");
+  b->size = 64;
+  b->text = (char *) malloc(b->size);
+  if (b->text == NULL)
+    cppfatal("Unable to malloc a cpp buffer");
+  b->len = 0;
+  b->text[0] = 0;
+  return (b);
+}
+
+// Append a character to a growable string
+static void bufaddc(struct cppbuf *b, int c) {
+  if (b->len + 1 >= b->size) {
+    b->size = b->size * 2;
+    b->text = (char *) realloc(b->text, b->size);
+    if (b->text == NULL)
+      cppfatal("Unable to realloc a cpp buffer");
+  }
+  b->text[b->len] = (char) c;
+  b->len = b->len + 1;
+  b->text[b->len] = 0;
+}
+
+// Append a string to a growable string
+static void bufadds(struct cppbuf *b, char *s) {
+  while (*s != 0) {
+    bufaddc(b, *s);
+    s++;
+  }
+}
+
+// Free the growable string but return its text
+static char *buftext(struct cppbuf *b) {
+  char *s;
+
+  s = b->text;
+  free(b);
+  return (s);
+}
+
+// Is c a character which can be in an identifier?
+static int identchar(int c) {
+  return (isalpha(c) || isdigit(c) || c == '_');
+}
+
+// Return the hash bucket for a macro name
+static int machash(char *name) {
+  int h = 0;
+
+  while (*name != 0) {
+    h = (h * 31 + *name) & 0x7fff;
+    name++;
+  }
+  return (h % NMACROHASH);
+}
+
+// Find a macro by name, or return NULL
+static struct macro *findmacro(char *name) {
+  struct macro *m;
+
+  for (m = Macrohash[machash(name)]; m != NULL; m = m->next)
+    if (!strcmp(m->name, name))
+      return (m);
+  return (NULL);
+}
+
+// Push a new input level on top of the others
+static struct cppinput *pushinput(void) {
+  struct cppinput *in;
+
+  in = (struct cppinput *) malloc(sizeof(struct cppinput));
+  if (in == NULL)
+    cppfatal("Unable to malloc a cpp input level");
+  in->file = NULL;
+  in->path = NULL;
+  in->name = NULL;
+  in->line = 1;
+  in->splices = 0;
+  in->ifbase = Ifdepth;
+  in->guard = NULL;
+  in->guardstate = G_START;
+  in->text = NULL;
+  in->pos = 0;
+  in->macro = NULL;
+  in->newlines = 0;
+  in->barrier = 0;
+  in->back = 0;
+#ifdef SCANBUFSIZE
+  in->buf = NULL;
+  in->ptr = NULL;
+  in->end = NULL;
+  in->mapped = 0;
+#endif
+  in->prev = Input;
+  Input = in;
+  return (in);
+}
+
+// Push some text to be read next
+static void pushtext(char *text, struct macro *m, int barrier) {
+  struct cppinput *in;
+
+  in = pushinput();
+  in->text = text;
+  in->macro = m;
+  in->barrier = barrier;
+  if (m != NULL) m->busy = 1;
+}
+
+// Drop the top input level, which is some text.
+// Any newlines from the macro call go out now
+static void poptext(void) {
+  struct cppinput *in;
+
+  in = Input;
+  if (in->macro != NULL) {
+    in->macro->busy = 0;
+    Checkpaste = 1;
+  }
+  Pendnl = Pendnl + in->newlines;
+  Input = in->prev;
+  free(in->text);
+  free(in);
+}
+
+#ifdef SCANBUFSIZE
+// On hosts, each file is read SCANBUFSIZE bytes at a time into
+// its own buffer, or is mapped into memory when we have mmap().
+// filegetc() takes its characters straight from the buffer, and
+// only calls fillinput() at the end of it
+
+// Map a file which we have just opened into memory if we can
+static void mapinput(struct cppinput *in) {
+#ifdef MMAPFILES
+  struct stat sb;
+  char *base;
+
+  if (fstat(fileno(in->file), &sb) == -1 || !S_ISREG(sb.st_mode) ||
+      sb.st_size == 0)
+    return;
+  base = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fileno(in->file), 0);
+  if (base == MAP_FAILED)
+    return;
+  madvise(base, sb.st_size, MADV_SEQUENTIAL);
+  in->buf = base;
+  in->ptr = base;
+  in->end = base + sb.st_size;
+  in->mapped = 1;
+#endif
+}
+
+// Get the next character from a file once its buffer
+// is empty: read in the next block, or return EOF
+static int fillinput(struct cppinput *in) {
+  int n;
+
+  if (in->mapped)
+    return (EOF);
+  if (in->buf == NULL) {
+    in->buf = (char *) malloc(SCANBUFSIZE);
+    if (in->buf == NULL)
+      cppfatal("Unable to malloc a cpp input buffer");
+  }
+  n = fread(in->buf, 1, SCANBUFSIZE, in->file);
+  if (n <= 0) {
+    in->ptr = in->end = in->buf;
+    return (EOF);
+  }
+  in->ptr = in->buf + 1;
+  in->end = in->buf + n;
+  return (in->buf[0] & 0xff);
+}
+
+// Free a file's buffer or mapping
+static void freeinput(struct cppinput *in) {
+#ifdef MMAPFILES
+  if (in->mapped) {
+    munmap(in->buf, in->end - in->buf);
+    return;
+  }
+#endif
+  free(in->buf);
+}
+
+#define filegetc(in) ((in)->ptr < (in)->end ? (*(in)->ptr++ & 0xff) : \
+		      fillinput(in))
+#else
+#define filegetc(in) fgetc((in)->file)
+#endif
+
+// Get the next character from the top input
+// level, or EOF at its end. In a file, skip
+// any backslash-newline and count the lines
+static int inputc(void) {
+  int c;
+  struct cppinput *in;
+
+  in = Input;
+  if (in->back != 0) {
+    c = in->back;
+    in->back = 0;
+    if (c == '\n' && in->file != NULL)
+      in->line = in->line + 1;
+    return (c);
+  }
+
+  if (in->file == NULL) {
+    c = in->text[in->pos];
+    if (c == 0)
+      return (EOF);
+    in->pos = in->pos + 1;
+    return (c);
+  }
+
+  while (1) {
+    c = filegetc(in);
+    if (c == '\n')
+      in->line = in->line + 1;
+    if (c != '\\')
+      return (c);
+    c = filegetc(in);
+    if (c != '\n') {
+      in->back = c;
+      return ('\\');
+    }
+    in->line = in->line + 1;
+    in->splices = in->splices + 1;
+  }
+  return (EOF);			// Keep -Wall happy
+}
+
+// Put back a character on the top input level
+static void unreadc(int c) {
+  if (c == EOF)
+    return;
+  if (c == '\n' && Input->file != NULL)
+    Input->line = Input->line - 1;
+  Input->back = c;
+}
+
+// Put a character back in front of those waiting to be sent
+static void pushout(int c) {
+  if (Outpos == Outlen) {
+    Outbuf[0] = (char) c;
+    Outpos = 0;
+    Outlen = 1;
+    return;
+  }
+  Outpos--;
+  Outbuf[Outpos] = (char) c;
+}
+
+// Queue a string to be sent
+static void queueout(char *s) {
+  Outpos = 0;
+  Outlen = strlen(s);
+  strcpy(Outbuf, s);
+}
+
+// Skip the rest of a /* comment in a file.
+// Count the newlines, as they must still be sent
+static int skipcomment(void) {
+  int c, last = 0, nl = 0;
+#ifdef SCANBUFSIZE
+  int n;
+#endif
+
+  while (1) {
+#ifdef SCANBUFSIZE
+    // Skip to the next '*', newline or backslash in one go,
+    // unless the last character may start the closing "*/"
+    if (last != '*' && Input->file != NULL && Input->back == 0) {
+      n = stopspan(Input->ptr, Input->end, '*', '\n', '\\');
+      if (n != 0) {
+	Input->ptr = Input->ptr + n;
+	last = 0;
+      }
+    }
+#endif
+    c = inputc();
+    if (c == EOF)
+      cppfatal("Unterminated comment");
+    if (c == '\n')
+      nl++;
+    if (last == '*' && c == '/')
+      return (nl);
+    last = c;
+  }
+  return (nl);			// Keep -Wall happy
+}
+
+// Read an identifier which starts with c
+// from the top input level into buf
+static void readident(int c, char *buf) {
+  int i = 0;
+#ifdef SCANBUFSIZE
+  struct cppinput *in = Input;
+  int n;
+#endif
+
+  while (identchar(c)) {
+    if (i == TEXTLEN - 1)
+      cppfatal("Identifier too long");
+    buf[i] = (char) c;
+    i++;
+#ifdef SCANBUFSIZE
+    // Copy the rest of it in a file's buffer in one go. If it
+    // ends there, leave the character after it in the buffer
+    if (in->file != NULL && in->back == 0) {
+      n = identspan(in->ptr, in->end);
+      if (i + n < TEXTLEN - 1) {
+	memcpy(buf + i, in->ptr, n);
+	in->ptr = in->ptr + n;
+	i = i + n;
+	if (in->ptr < in->end && *in->ptr != '\\') {
+	  buf[i] = 0;
+	  return;
+	}
+      }
+    }
+#endif
+    c = inputc();
+  }
+  buf[i] = 0;
+  unreadc(c);
+}
+
+// Return true if the characters a and b would run
+// together as one token and so need a space between them
+static int pastes(int a, int b) {
+  if (identchar(a))
+    return (identchar(b));
+  switch (a) {
+    case '+':
+      return (b == '+' || b == '=');
+    case '-':
+      return (b == '-' || b == '=' || b == '>');
+    case '&':
+      return (b == '&' || b == '=');
+    case '|':
+      return (b == '|' || b == '=');
+    case '<':
+      return (b == '<' || b == '=');
+    case '>':
+      return (b == '>' || b == '=');
+    case '/':
+      return (b == '/' || b == '*' || b == '=');
+    case '.':
+      return (b == '.' || isdigit(b));
+    case '=':
+    case '!':
+    case '*':
+    case '%':
+    case '^':
+      return (b == '=');
+  }
+  return (0);
+}
+
+// Make a copy of a macro argument as a string literal.
+// Put a backslash before each '"', and before each
+// backslash inside a string or character literal
+static char *stringize(char *arg) {
+  struct cppbuf *b;
+  int quote = 0;
+  int c;
+
+  b = newbuf();
+  bufaddc(b, '"');
+  while (*arg != 0) {
+    // Outside a literal, each run of blanks becomes one space
+    c = *arg;
+    if (quote == 0 && (c == ' ' || c == '\t')) {
+      while (c == ' ' || c == '\t') {
+	arg++;
+	c = *arg;
+      }
+      bufaddc(b, ' ');
+      continue;
+    }
+    if (*arg == '"' || (quote != 0 && *arg == '\\'))
+      bufaddc(b, '\\');
+    bufaddc(b, *arg);
+    if (quote != 0 && *arg == '\\' && arg[1] != 0) {
+      arg++;
+      if (*arg == '"' || *arg == '\\')
+	bufaddc(b, '\\');
+      bufaddc(b, *arg);
+    } else if (quote != 0 && *arg == quote)
+      quote = 0;
+    else if (quote == 0 && *arg == '"')
+      quote = *arg;
+    else if (quote == 0 && *arg == 39)	// A single quote
+      quote = *arg;
+    arg++;
+  }
+  bufaddc(b, '"');
+  return (buftext(b));
+}
+
+// Macro expand some text and return the result
+static char *expandtext(char *text) {
+  struct cppbuf *b;
+  int c, lastc, checkpaste;
+
+  // We are in the middle of sending characters
+  // to the scanner, so save the state of that
+  lastc = Lastc;
+  checkpaste = Checkpaste;
+  Lastc = ' ';
+  Checkpaste = 0;
+
+  b = newbuf();
+  pushtext(strdup(text), NULL, 1);
+  while ((c = nextexp()) != EOF)
+    bufaddc(b, c);
+  poptext();
+
+  Lastc = lastc;
+  Checkpaste = checkpaste;
+  return (buftext(b));
+}
+
+// Skip whitespace while looking for the '(' after
+// the name of a function-like macro. We can go past
+// the end of a macro's expansion but not a file.
+// Count the newlines in a file
+static int skipspace(int *nl) {
+  int c;
+
+  while (1) {
+    c = inputc();
+    if (c == EOF) {
+      if (Input->file != NULL || Input->barrier)
+	return (EOF);
+      poptext();
+      continue;
+    }
+    if (c == '\n' && Input->file != NULL)
+      *nl = *nl + 1;
+    else if (c != ' ' && c != '\t' && c != '\n' && c != '\r' && c != '\f')
+      return (c);
+  }
+  return (EOF);			// Keep -Wall happy
+}
+
+// Read the arguments of a macro call up to the
+// closing ')'. Put each argument's offset into
+// argoff[] and return the buffer holding them
+static struct cppbuf *readargs(struct macro *m, int *argoff, int *nl) {
+  struct cppbuf *b;
+  int c, c2, depth = 0, nargs = 0, quote = 0;
+
+  b = newbuf();
+  argoff[0] = 0;
+  while (1) {
+    c = inputc();
+    if (c == EOF) {
+      if (Input->file != NULL || Input->barrier)
+	cppfatals("Unterminated call to macro", m->name);
+      poptext();
+      continue;
+    }
+
+    // Newlines and comments in a file become spaces
+    if (c == '\n') {
+      if (Input->file != NULL)
+	*nl = *nl + 1;
+      c = ' ';
+    }
+    if (c == '/' && quote == 0 && Input->file != NULL) {
+      c2 = inputc();
+      if (c2 == '*') {
+	*nl = *nl + skipcomment();
+	c = ' ';
+      } else
+	unreadc(c2);
+    }
+
+    // Copy literals as they are
+    if (quote != 0) {
+      bufaddc(b, c);
+      if (c == '\\') {
+	c = inputc();
+	bufaddc(b, c);
+      } else if (c == quote)
+	quote = 0;
+      continue;
+    }
+    if (c == '"' || c == '\'')
+      quote = c;
+
+    // Look for the end of each argument
+    if (c == '(')
+      depth++;
+    if (depth == 0 && (c == ',' || c == ')')) {
+      while (b->len > argoff[nargs] && b->text[b->len - 1] == ' ') {
+	b->len = b->len - 1;
+	b->text[b->len] = 0;
+      }
+      bufaddc(b, 0);
+      nargs++;
+      if (c == ')')
+	break;
+      if (nargs == MAXPARAMS)
+	cppfatals("Too many arguments to macro", m->name);
+      argoff[nargs] = b->len;
+      continue;
+    }
+    if (c == ')')
+      depth--;
+
+    // Skip the leading space in each argument
+    if (b->len == argoff[nargs] && (c == ' ' || c == '\t'))
+      continue;
+    bufaddc(b, c);
+  }
+
+  // A macro with no parameters gets one empty argument
+  if (m->nparams == 0 && nargs == 1 && b->text[0] == 0)
+    nargs = 0;
+  if (nargs != m->nparams)
+    cppfatals("Wrong number of arguments to macro", m->name);
+  return (b);
+}
+
+// Substitute the arguments into the body
+// of a function-like macro and return the result
+static char *substitute(struct macro *m, char *args, int *argoff) {
+  struct cppbuf *b;
+  char *expanded[MAXPARAMS];
+  char *s, *arg;
+  int i, raw;
+
+  for (i = 0; i < m->nparams; i++)
+    expanded[i] = NULL;
+
+  b = newbuf();
+  for (s = m->body; *s != 0; s++) {
+    switch (*s) {
+      case MPASTE:
+	break;
+      case MSTRING:
+	s++;
+	arg = stringize(args + argoff[*s - 1]);
+	bufadds(b, arg);
+	free(arg);
+	break;
+      case MPARAM:
+	// Next to a ##, use the argument as it is.
+	// Otherwise, macro expand it first
+	raw = 0;
+	if (s != m->body && *(s - 1) == MPASTE)
+	  raw = 1;
+	if (s[2] == MPASTE)
+	  raw = 1;
+	s++;
+	i = *s - 1;
+	if (raw) {
+	  bufadds(b, args + argoff[i]);
+	  break;
+	}
+	if (expanded[i] == NULL)
+	  expanded[i] = expandtext(args + argoff[i]);
+	bufadds(b, expanded[i]);
+	break;
+      default:
+	bufaddc(b, *s);
+    }
+  }
+
+  for (i = 0; i < m->nparams; i++)
+    if (expanded[i] != NULL)
+      free(expanded[i]);
+  return (buftext(b));
+}
+
+// The name of macro m has just been read. Push its
+// expansion as the next input and return 1. But
+// return 0 if it is a function-like macro with no '('
+static int expandmacro(struct macro *m) {
+  struct cppbuf *args;
+  int argoff[MAXPARAMS];
+  int c, nl = 0;
+
+  if (m->nparams == -1) {
+    pushtext(strdup(m->body), m, 0);
+    Checkpaste = 1;
+    return (1);
+  }
+
+  // No '(', so it's not a call. Send any newlines
+  // we skipped after the name
+  c = skipspace(&nl);
+  if (c != '(') {
+    unreadc(c);
+    Pendnl = Pendnl + nl;
+    if (nl != 0)
+      Bol = 1;
+    return (0);
+  }
+
+  args = readargs(m, argoff, &nl);
+  pushtext(substitute(m, args->text, argoff), m, 0);
+  Input->newlines = nl;
+  Checkpaste = 1;
+  free(buftext(args));
+  return (1);
+}
+
+// Mark the file we are in as not guarded
+// unless we are inside its guard group
+static void notguarded(void) {
+  if (Curfile->guardstate != G_INSIDE)
+    Curfile->guardstate = G_NONE;
+}
+
+// Get the next character from the input after macro
+// expansion, or EOF at the end of a file or some text
+// which is being expanded on its own. Comments in a
+// file come out as a space.
+static int expandc(void) {
+  int c, c2;
+  struct macro *m;
+  char ident[TEXTLEN + 1];
+
+  while (1) {
+    if (Outpos < Outlen) {
+      c = Outbuf[Outpos];
+      Outpos++;
+      return (c);
+    }
+
+    c = inputc();
+
+    // Copy the rest of a literal or a number
+    if (Inquote != 0) {
+      if (c == EOF || c == '\n') {
+	Inquote = 0;
+	Escaped = 0;
+      } else {
+	if (Escaped)
+	  Escaped = 0;
+	else if (c == '\\')
+	  Escaped = 1;
+	else if (c == Inquote)
+	  Inquote = 0;
+	return (c);
+      }
+    }
+    if (Innumber) {
+      if (identchar(c) || c == '.')
+	return (c);
+      Innumber = 0;
+    }
+
+    if (c == EOF) {
+      if (Input->file != NULL || Input->barrier)
+	return (EOF);
+      if (Input->newlines != 0) {
+	poptext();
+	return (' ');
+      }
+      poptext();
+      continue;
+    }
+
+    if (c == '/' && Input->file != NULL) {
+      c2 = inputc();
+      if (c2 == '*') {
+	Pendnl = Pendnl + skipcomment();
+	return (' ');
+      }
+      if (c2 == '/') {
+	c2 = inputc();
+	while (c2 != '\n' && c2 != EOF)
+	  c2 = inputc();
+	unreadc(c2);
+	return (' ');
+      }
+      unreadc(c2);
+      return (c);
+    }
+
+    if (c == '"' || c == '\'') {
+      Inquote = c;
+      return (c);
+    }
+    if (isdigit(c)) {
+      Innumber = 1;
+      return (c);
+    }
+    if (!identchar(c))
+      return (c);
+
+    // An identifier. Expand it if it's a macro
+    readident(c, ident);
+    m = findmacro(ident);
+    if (m != NULL && m->busy == 0 && expandmacro(m))
+      continue;
+
+    if (!strcmp(ident, "__LINE__"))
+      sprintf(ident, "%d", Curfile->line);
+    else if (!strcmp(ident, "__FILE__") && strlen(Curfile->name) < TEXTLEN - 2)
+      sprintf(ident, "\"%s\"", Curfile->name);
+    queueout(ident);
+  }
+  return (EOF);			// Keep -Wall happy
+}
+
+// Get the next character after macro expansion,
+// with a space between an expansion and the text
+// on either side of it when they would run together
+static int nextexp(void) {
+  int c;
+
+  c = expandc();
+  if (c == EOF)
+    return (EOF);
+  if (Checkpaste) {
+    Checkpaste = 0;
+    if (pastes(Lastc, c)) {
+      pushout(c);
+      c = ' ';
+    }
+  }
+  Lastc = c;
+  return (c);
+}
+
+// Read the rest of a directive line into Dline.
+// Comments become spaces, but their newlines are
+// still sent. Literals are copied as they are
+static void readline(void) {
+  int c, c2, i = 0, quote = 0;
+
+  while (1) {
+    c = inputc();
+    if (c == EOF || c == '\n')
+      break;
+    if (quote != 0) {
+      if (c == '\\') {
+	Dline[i] = (char) c;
+	i++;
+	c = inputc();
+      } else if (c == quote)
+	quote = 0;
+    } else if (c == '"' || c == '\'') {
+      quote = c;
+    } else if (c == '/') {
+      c2 = inputc();
+      if (c2 == '*') {
+	Pendnl = Pendnl + skipcomment();
+	c = ' ';
+      } else if (c2 == '/') {
+	c2 = inputc();
+	while (c2 != '\n' && c2 != EOF)
+	  c2 = inputc();
+	break;
+      } else
+	unreadc(c2);
+    }
+    if (i >= CPPLINELEN - 2)
+      cppfatal("Pre-processor line too long");
+    Dline[i] = (char) c;
+    i++;
+  }
+
+  // Strip the trailing space
+  while (i > 0 && (Dline[i - 1] == ' ' || Dline[i - 1] == '\t'))
+    i--;
+  Dline[i] = 0;
+  Dp = Dline;
+}
+
+// Skip spaces in the directive line
+static void dskip(void) {
+  while (*Dp == ' ' || *Dp == '\t')
+    Dp++;
+}
+
+// Get the next word from the directive line into buf
+static void dword(char *buf) {
+  int i = 0;
+
+  dskip();
+  while (identchar(*Dp)) {
+    if (i == TEXTLEN - 1)
+      cppfatal("Identifier too long");
+    buf[i] = *Dp;
+    i++;
+    Dp++;
+  }
+  buf[i] = 0;
+}
+
+// Parse the rest of a #define line in Dline
+static void define(void) {
+  char mname[TEXTLEN + 1];
+  char name[TEXTLEN + 1];
+  char *params[MAXPARAMS];
+  struct macro *m;
+  struct cppbuf *b;
+  int i, h, nparams = -1, quote = 0;
+
+  dword(mname);
+  if (mname[0] == 0)
+    cppfatal("Missing macro name in #define");
+
+  // Get the names of any parameters
+  if (*Dp == '(') {
+    Dp++;
+    nparams = 0;
+    dskip();
+    while (*Dp != ')') {
+      if (nparams == MAXPARAMS)
+	cppfatals("Too many parameters to macro", mname);
+      params[nparams] = (char *) malloc(TEXTLEN + 1);
+      dword(params[nparams]);
+      if (params[nparams][0] == 0)
+	cppfatals("Bad parameter list for macro", mname);
+      nparams++;
+      dskip();
+      if (*Dp == ',')
+	Dp++;
+      else if (*Dp != ')')
+	cppfatals("Bad parameter list for macro", mname);
+    }
+    Dp++;
+  }
+  dskip();
+
+  // Copy the body, marking the uses of the parameters
+  b = newbuf();
+  while (*Dp != 0) {
+    if (quote != 0) {
+      bufaddc(b, *Dp);
+      if (*Dp == '\\' && Dp[1] != 0) {
+	Dp++;
+	bufaddc(b, *Dp);
+      } else if (*Dp == quote)
+	quote = 0;
+      Dp++;
+      continue;
+    }
+    if (*Dp == '"' || *Dp == '\'') {
+      quote = *Dp;
+      bufaddc(b, *Dp);
+      Dp++;
+      continue;
+    }
+
+    // ## joins the text on either side, less any space
+    if (*Dp == '#' && Dp[1] == '#') {
+      while (b->len > 0 && b->text[b->len - 1] == ' ')
+	b->len = b->len - 1;
+      bufaddc(b, MPASTE);
+      Dp = Dp + 2;
+      dskip();
+      continue;
+    }
+    if (*Dp == '#' && nparams > 0) {
+      Dp++;
+      dskip();
+      dword(name);
+      for (i = 0; i < nparams; i++)
+	if (!strcmp(name, params[i]))
+	  break;
+      if (i == nparams)
+	cppfatal("# is not followed by a macro parameter");
+      bufaddc(b, MSTRING);
+      bufaddc(b, i + 1);
+      continue;
+    }
+
+    if (isdigit(*Dp)) {
+      while (identchar(*Dp) || *Dp == '.') {
+	bufaddc(b, *Dp);
+	Dp++;
+      }
+      continue;
+    }
+    if (!identchar(*Dp)) {
+      if (*Dp == '\t')
+	bufaddc(b, ' ');
+      else
+	bufaddc(b, *Dp);
+      Dp++;
+      continue;
+    }
+
+    dword(name);
+    for (i = 0; i < nparams; i++)
+      if (!strcmp(name, params[i]))
+	break;
+    if (i < nparams) {
+      bufaddc(b, MPARAM);
+      bufaddc(b, i + 1);
+    } else
+      bufadds(b, name);
+  }
+
+  for (i = 0; i < nparams; i++)
+    free(params[i]);
+
+  // Replace any earlier definition
+  m = findmacro(mname);
+  if (m == NULL) {
+    m = (struct macro *) malloc(sizeof(struct macro));
+    if (m == NULL)
+      cppfatal("Unable to malloc a macro");
+    m->name = strdup(mname);
+    m->busy = 0;
+    h = machash(mname);
+    m->next = Macrohash[h];
+    Macrohash[h] = m;
+  } else
+    free(m->body);
+  m->nparams = nparams;
+  m->body = buftext(b);
+}
+
+// Remove a macro definition. We keep the
+// macro in its bucket, but with no name
+static void undef(void) {
+  char name[TEXTLEN + 1];
+  struct macro *m;
+
+  dword(name);
+  m = findmacro(name);
+  if (m != NULL) {
+    free(m->name);
+    m->name = strdup("");
+  }
+}
+
+// Replace each "defined X" or "defined(X)" in
+// an #if expression by 1 or 0, and return the result
+static char *replacedefined(void) {
+  struct cppbuf *b;
+  char name[TEXTLEN + 1];
+  int paren;
+
+  b = newbuf();
+  while (*Dp != 0) {
+    if (!identchar(*Dp)) {
+      bufaddc(b, *Dp);
+      Dp++;
+      continue;
+    }
+    dword(name);
+    if (strcmp(name, "defined")) {
+      bufadds(b, name);
+      continue;
+    }
+    dskip();
+    paren = 0;
+    if (*Dp == '(') {
+      paren = 1;
+      Dp++;
+    }
+    dword(name);
+    dskip();
+    if (paren) {
+      if (*Dp != ')')
+	cppfatal("Missing ')' after defined");
+      Dp++;
+    }
+    if (findmacro(name) != NULL)
+      bufadds(b, " 1 ");
+    else
+      bufadds(b, " 0 ");
+  }
+  return (buftext(b));
+}
+
+static long evalcond(void);
+
+// Skip spaces in an #if expression
+static void eskip(void) {
+  while (*Ep == ' ' || *Ep == '\t')
+    Ep++;
+}
+
+// Get a number, character constant, unary operation
+// or parenthesised expression in an #if expression.
+// Any identifier left after macro expansion is 0
+static long evalunary(void) {
+  long val = 0;
+  int radix = 10, k;
+
+  eskip();
+  switch (*Ep) {
+    case '!':
+      Ep++;
+      return (!evalunary());
+    case '~':
+      Ep++;
+      return (~evalunary());
+    case '-':
+      Ep++;
+      return (-evalunary());
+    case '+':
+      Ep++;
+      return (evalunary());
+    case '(':
+      Ep++;
+      val = evalcond();
+      eskip();
+      if (*Ep != ')')
+	cppfatal("Missing ')' in #if expression");
+      Ep++;
+      return (val);
+    case '\'':
+      Ep++;
+      if (*Ep == '\\') {
+	Ep++;
+	switch (*Ep) {
+	  case 'n':
+	    val = '\n';
+	    break;
+	  case 't':
+	    val = '\t';
+	    break;
+	  case '0':
+	    val = 0;
+	    break;
+	  default:
+	    val = *Ep;
+	}
+      } else
+	val = *Ep;
+      Ep++;
+      if (*Ep != '\'')
+	cppfatal("Bad character constant in #if expression");
+      Ep++;
+      return (val);
+  }
+
+  if (isdigit(*Ep)) {
+    if (*Ep == '0') {
+      radix = 8;
+      Ep++;
+      if (*Ep == 'x' || *Ep == 'X') {
+	radix = 16;
+	Ep++;
+      }
+    }
+    while (isdigit(*Ep) || (radix == 16 && isxdigit(*Ep))) {
+      if (isdigit(*Ep))
+	k = *Ep - '0';
+      else
+	k = tolower(*Ep) - 'a' + 10;
+      val = val * radix + k;
+      Ep++;
+    }
+    while (*Ep == 'l' || *Ep == 'L' || *Ep == 'u' || *Ep == 'U')
+      Ep++;
+    return (val);
+  }
+
+  if (identchar(*Ep)) {
+    while (identchar(*Ep))
+      Ep++;
+    return (0);
+  }
+  cppfatal("Bad #if expression");
+  return (0);			// Keep -Wall happy
+}
+
+// Return the precedence of the binary operator
+// in the #if expression, or 0 if there isn't one.
+// Set *op to a character which stands for it and
+// *len to its length
+static int binprec(int *op, int *len) {
+  int a, b;
+
+  a = Ep[0];
+  b = Ep[1];
+  *op = a;
+  *len = 2;
+  if (a == '|' && b == '|') { *op = 'o'; return (1); }
+  if (a == '&' && b == '&') { *op = 'a'; return (2); }
+  if (a == '=' && b == '=') { *op = 'e'; return (6); }
+  if (a == '!' && b == '=') { *op = 'n'; return (6); }
+  if (a == '<' && b == '=') { *op = 'l'; return (7); }
+  if (a == '>' && b == '=') { *op = 'g'; return (7); }
+  if (a == '<' && b == '<') { *op = 'L'; return (8); }
+  if (a == '>' && b == '>') { *op = 'R'; return (8); }
+  *len = 1;
+  switch (a) {
+    case '|':
+      return (3);
+    case '^':
+      return (4);
+    case '&':
+      return (5);
+    case '<':
+    case '>':
+      return (7);
+    case '+':
+    case '-':
+      return (9);
+    case '*':
+    case '/':
+    case '%':
+      return (10);
+  }
+  return (0);
+}
+
+// Evaluate binary operations in an #if expression
+// with at least the given precedence
+static long evalbinary(int minprec) {
+  long val, rhs;
+  int prec, op, len;
+
+  val = evalunary();
+  while (1) {
+    eskip();
+    prec = binprec(&op, &len);
+    if (prec == 0 || prec < minprec)
+      return (val);
+    Ep = Ep + len;
+    rhs = evalbinary(prec + 1);
+    switch (op) {
+      case 'o': val = (val != 0 || rhs != 0); break;
+      case 'a': val = (val != 0 && rhs != 0); break;
+      case '|': val = val | rhs; break;
+      case '^': val = val ^ rhs; break;
+      case '&': val = val & rhs; break;
+      case 'e': val = (val == rhs); break;
+      case 'n': val = (val != rhs); break;
+      case '<': val = (val < rhs); break;
+      case '>': val = (val > rhs); break;
+      case 'l': val = (val <= rhs); break;
+      case 'g': val = (val >= rhs); break;
+      case 'L': val = val << rhs; break;
+      case 'R': val = val >> rhs; break;
+      case '+': val = val + rhs; break;
+      case '-': val = val - rhs; break;
+      case '*': val = val * rhs; break;
+      case '/':
+      case '%':
+	if (rhs == 0)
+	  cppfatal("Division by zero in #if expression");
+	if (op == '/')
+	  val = val / rhs;
+	else
+	  val = val % rhs;
+	break;
+    }
+  }
+  return (val);			// Keep -Wall happy
+}
+
+// Evaluate a conditional expression in an #if
+static long evalcond(void) {
+  long val, a, b;
+
+  val = evalbinary(1);
+  eskip();
+  if (*Ep != '?')
+    return (val);
+  Ep++;
+  a = evalcond();
+  eskip();
+  if (*Ep != ':')
+    cppfatal("Missing ':' in #if expression");
+  Ep++;
+  b = evalcond();
+  if (val != 0)
+    return (a);
+  return (b);
+}
+
+// Evaluate the expression in the rest of
+// an #if or #elif line. Return 1 if true
+static int evalif(void) {
+  char *text, *expr;
+  long val;
+
+  text = replacedefined();
+  expr = expandtext(text);
+  Ep = expr;
+  val = evalcond();
+  eskip();
+  if (*Ep != 0)
+    cppfatal("Bad #if expression");
+  free(text);
+  free(expr);
+  return (val != 0);
+}
+
+// Are we in a group of lines which is false?
+static int skipping(void) {
+  return (Ifdepth > 0 && Ifstate[Ifdepth - 1] != IF_ACTIVE);
+}
+
+// Start a new #if group, which is true or not
+static void pushif(int cond) {
+  if (Ifdepth == MAXIFDEPTH)
+    cppfatal("#if nested too deeply");
+  if (skipping())
+    Ifstate[Ifdepth] = IF_SKIP;
+  else if (cond)
+    Ifstate[Ifdepth] = IF_ACTIVE;
+  else
+    Ifstate[Ifdepth] = IF_WAIT;
+  Ifdepth++;
+}
+
+// Try to open an included file: the directory of the
+// current file first if quoted, then the -I directories.
+// Return the name of the file which was found, or NULL
+static char *findinclude(char *name, int quoted) {
+  char *path, *slash;
+  FILE *f;
+  int i;
+
+  path = (char *) malloc(CPPLINELEN + TEXTLEN + 2);
+  if (path == NULL)
+    cppfatal("Unable to malloc an include file name");
+
+  for (i = -1; i < Nincdirs; i++) {
+    if (i == -1) {
+      if (quoted == 0)
+	continue;
+      strcpy(path, Curfile->path);
+      slash = strrchr(path, '/');
+      if (slash == NULL) {
+	strcpy(path, name);
+      } else {
+	slash[1] = 0;
+	strcat(path, name);
+      }
+    } else {
+      strcpy(path, Incdir[i]);
+      strcat(path, "/");
+      strcat(path, name);
+    }
+    f = fopen(path, "r");
+    if (f != NULL) {
+      fclose(f);
+      return (path);
+    }
+  }
+  free(path);
+  return (NULL);
+}
+
+// Start reading a source file
+static void pushfile(char *name) {
+  struct cppinput *in;
+
+  in = pushinput();
+  in->file = fopen(name, "r");
+  if (in->file == NULL)
+    cppfatals("Unable to open", name);
+  in->path = name;
+  in->name = name;
+#ifdef SCANBUFSIZE
+  mapinput(in);
+#endif
+  Curfile = in;
+  Bol = 1;
+  Heldnl = 0;
+  setfileline(name, 1);
+}
+
+// Obey the #include in the rest of Dline.
+// Return 1 if we have started on the new file
+static int include(void) {
+  char *name, *path, *expanded = NULL;
+  struct guardfile *g;
+  int quoted, end;
+
+  // The name may come from a macro
+  dskip();
+  if (*Dp != '"' && *Dp != '<') {
+    expanded = expandtext(Dp);
+    Dp = expanded;
+    dskip();
+  }
+  if (*Dp == '"') {
+    quoted = 1;
+    end = '"';
+  } else if (*Dp == '<') {
+    quoted = 0;
+    end = '>';
+  } else
+    cppfatal("Bad #include file name");
+
+  Dp++;
+  name = Dp;
+  while (*Dp != 0 && *Dp != end)
+    Dp++;
+  if (*Dp == 0)
+    cppfatal("Bad #include file name");
+  *Dp = 0;
+
+  path = findinclude(name, quoted);
+  if (path == NULL)
+    cppfatals("Unable to find include file", name);
+  if (expanded != NULL)
+    free(expanded);
+
+  // Skip a guarded file whose guard is defined
+  for (g = Guardhead; g != NULL; g = g->next)
+    if (!strcmp(g->name, path) && findmacro(g->guard) != NULL) {
+      free(path);
+      return (0);
+    }
+
+  pushfile(path);
+  return (1);
+}
+
+// Obey the #line in the rest of Dline. Like #include, the
+// scanner gets the new line number, and any new file name,
+// instead of the directive's newline
+static void linedirective(void) {
+  char *expanded, *name;
+  int line = 0;
+
+  expanded = expandtext(Dp);
+  Dp = expanded;
+  dskip();
+  if (!isdigit(*Dp))
+    cppfatal("Bad #line directive");
+  while (isdigit(*Dp)) {
+    line = line * 10 + *Dp - '0';
+    Dp++;
+  }
+  dskip();
+  if (*Dp == '"') {
+    Dp++;
+    name = Dp;
+    while (*Dp != 0 && *Dp != '"')
+      Dp++;
+    if (*Dp == 0)
+      cppfatal("Bad #line directive");
+    *Dp = 0;
+    Dp++;
+    if (Curfile->name != Curfile->path)
+      free(Curfile->name);
+    Curfile->name = strdup(name);
+    dskip();
+  }
+  if (*Dp != 0)
+    cppfatal("Bad #line directive");
+  free(expanded);
+
+  Curfile->line = line;
+  Curfile->splices = 0;
+  Pendnl = 0;
+  Heldnl = 0;
+  setfileline(Curfile->name, line);
+}
+
+// Obey the directive whose '#' we have just read
+static void directive(void) {
+  char name[TEXTLEN + 1];
+  int state;
+
+  readline();
+  dword(name);
+
+  // A file whose first directive is #ifndef may be guarded
+  if (Curfile->guardstate == G_START && Ifdepth == Curfile->ifbase &&
+      !strcmp(name, "ifndef")) {
+    dword(name);
+    Curfile->guard = strdup(name);
+    Curfile->guardstate = G_INSIDE;
+    pushif(findmacro(Curfile->guard) == NULL);
+    Pendnl++;
+    return;
+  }
+
+  // Any other directive outside the guard group
+  // means that the file isn't guarded
+  if (Ifdepth == Curfile->ifbase)
+    notguarded();
+  if (Ifdepth == Curfile->ifbase + 1 && Curfile->guardstate == G_INSIDE) {
+    if (!strcmp(name, "else") || !strcmp(name, "elif"))
+      Curfile->guardstate = G_NONE;
+  }
+
+  // The directive's own newline
+  Pendnl++;
+
+  if (!strcmp(name, "ifdef")) {
+    dword(name);
+    pushif(findmacro(name) != NULL);
+    return;
+  }
+  if (!strcmp(name, "ifndef")) {
+    dword(name);
+    pushif(findmacro(name) == NULL);
+    return;
+  }
+  if (!strcmp(name, "if")) {
+    if (skipping())
+      pushif(0);
+    else
+      pushif(evalif());
+    return;
+  }
+  if (!strcmp(name, "elif") || !strcmp(name, "else") ||
+      !strcmp(name, "endif")) {
+    if (Ifdepth == Curfile->ifbase)
+      cppfatals("No #if before this", name);
+    state = Ifstate[Ifdepth - 1];
+    if (!strcmp(name, "endif")) {
+      Ifdepth--;
+      if (Ifdepth == Curfile->ifbase && Curfile->guardstate == G_INSIDE)
+	Curfile->guardstate = G_CLOSED;
+      return;
+    }
+    if (state == IF_ACTIVE)
+      Ifstate[Ifdepth - 1] = IF_DONE;
+    if (state == IF_WAIT) {
+      if (!strcmp(name, "else") || evalif())
+	Ifstate[Ifdepth - 1] = IF_ACTIVE;
+    }
+    return;
+  }
+
+  // The remaining directives are ignored in a false group
+  if (skipping())
+    return;
+
+  if (!strcmp(name, "define")) {
+    define();
+    return;
+  }
+  if (!strcmp(name, "undef")) {
+    undef();
+    return;
+  }
+  if (!strcmp(name, "include")) {
+    // The scanner gets a new file and line number instead
+    // of the newlines. It gets the line after the #include
+    // when we return to this file
+    if (include()) {
+      Input->prev->splices = 0;
+      Pendnl = 0;
+    }
+    return;
+  }
+  if (!strcmp(name, "error"))
+    cppfatals("#error", Dp);
+  if (!strcmp(name, "warning")) {
+    fprintf(stderr, "#warning%s on line %d of %s\n", Dp, Dirline,
+	    Curfile->name);
+    return;
+  }
+  if (!strcmp(name, "line")) {
+    linedirective();
+    return;
+  }
+  if (!strcmp(name, "pragma") || name[0] == 0)
+    return;
+  cppfatals("Unknown pre-processor directive", name);
+}
+
+// Skip a line in a false #if group,
+// given its first non-blank character
+static void skipline(int c) {
+  int c2;
+
+  while (c != '\n' && c != EOF) {
+    if (c == '/') {
+      c2 = inputc();
+      if (c2 == '*')
+	Pendnl = Pendnl + skipcomment();
+      else
+	unreadc(c2);
+    }
+#ifdef SCANBUFSIZE
+    // Skip to the next '/', newline or backslash in one go
+    if (Input->back == 0)
+      Input->ptr = Input->ptr +
+	stopspan(Input->ptr, Input->end, '/', '\n', '\\');
+#endif
+    c = inputc();
+  }
+  Pendnl++;
+}
+
+// We have reached the end of an included
+// file. Go back to the file which included it
+static void endinclude(void) {
+  struct cppinput *in;
+  struct guardfile *g;
+
+  in = Input;
+  if (in->guardstate == G_CLOSED) {
+    g = (struct guardfile *) malloc(sizeof(struct guardfile));
+    if (g == NULL)
+      cppfatal("Unable to malloc a guarded file");
+    g->name = in->path;
+    g->guard = in->guard;
+    g->next = Guardhead;
+    Guardhead = g;
+  } else
+    free(in->path);
+  if (in->name != in->path)
+    free(in->name);
+#ifdef SCANBUFSIZE
+  freeinput(in);
+#endif
+  fclose(in->file);
+  Input = in->prev;
+  Curfile = Input;
+  free(in);
+  Bol = 1;
+  Heldnl = 0;
+  setfileline(Curfile->name, Curfile->line);
+}
+
+// Get the next character of the pre-processed input,
+// before any blank lines are held back
+static int cppnext(void) {
+  int c;
+
+  while (1) {
+    // Send any waiting newlines
+    if (Outpos == Outlen && Pendnl > 0) {
+      Pendnl--;
+      Lastc = '\n';
+      return ('\n');
+    }
+
+    // At the start of a line in a file, look for a
+    // directive, or skip the line if in a false group
+    if (Bol && Outpos == Outlen && Input->file != NULL) {
+#ifdef SCANBUFSIZE
+      if (Input->back == 0)
+	Input->ptr = Input->ptr + blankspan(Input->ptr, Input->end);
+#endif
+      c = inputc();
+      while (c == ' ' || c == '\t' || c == '\f' || c == '\r')
+	c = inputc();
+      if (c == '#') {
+	Dirline = Curfile->line;
+	directive();
+	Dirline = 0;
+	Pendnl = Pendnl + Curfile->splices;
+	Curfile->splices = 0;
+	continue;
+      }
+      if (skipping() && c != EOF) {
+	skipline(c);
+	Pendnl = Pendnl + Curfile->splices;
+	Curfile->splices = 0;
+	continue;
+      }
+      Bol = 0;
+      unreadc(c);
+    }
+
+    c = nextexp();
+    if (c == EOF) {
+      if (Ifdepth > Curfile->ifbase)
+	cppfatal("Missing #endif at end of file");
+      if (Input->prev == NULL)
+	return (EOF);
+      endinclude();
+      continue;
+    }
+
+    if (c == '\n') {
+      Bol = 1;
+      Pendnl = Pendnl + Curfile->splices;
+      Curfile->splices = 0;
+    } else if (c != ' ' && c != '\t' && c != '\r' && c != '\f')
+      notguarded();
+    return (c);
+  }
+  return (EOF);			// Keep -Wall happy
+}
+
+// Get the next character of the pre-processed input.
+// Like cpp, we leave out any blank lines at the end of
+// the input. So we hold them back until something else
+// comes. A change of file or line drops them, as the
+// scanner gets told the new line number anyway
+int cppgetc(void) {
+  int c;
+
+  while (1) {
+    if (Heldnl > 0 && Outpos < Outlen) {
+      Heldnl--;
+      return ('\n');
+    }
+    c = cppnext();
+    if (c == EOF)
+      return (EOF);
+    if (c == '\n' && Lastsent == '\n') {
+      Heldnl++;
+      continue;
+    }
+    Lastsent = c;
+    if (Heldnl == 0)
+      return (c);
+    pushout(c);
+  }
+  return (EOF);			// Keep -Wall happy
+}
+
+#ifdef SCANBUFSIZE
+// On hosts, the scanner takes the characters which would come
+// out of cppgetc() just as they are straight from our buffers,
+// so that it can look at them a word at a time. These are the
+// rest of an identifier or other text waiting to be sent, or
+// the blanks or the plain characters in a literal which come
+// next in a file. None of them is a newline
+static char *Spanstart;		// Start of the span we gave out
+static int Spanfile;		// Is the span in a file's buffer?
+
+// Set *start to the next span of characters
+// and return its length, which may be zero
+int cppspan(char **start) {
+  struct cppinput *in = Input;
+  int n = 0;
+
+  Spanstart = NULL;
+  if (Heldnl != 0 || Checkpaste != 0) {
+    *start = NULL;
+    return (0);
+  }
+
+  // The text waiting to be sent
+  if (Outpos < Outlen) {
+    while (Outpos + n < Outlen && Outbuf[Outpos + n] != '\n')
+      n++;
+    Spanstart = Outbuf + Outpos;
+    Spanfile = 0;
+    *start = Spanstart;
+    return (n);
+  }
+
+  // The plain characters in a literal, up to its quote
+  // or a backslash. Outside one, anything but an identifier,
+  // a number, a comment, a literal or a backslash
+  if (Pendnl == 0 && Bol == 0 && in->file != NULL && in->back == 0 &&
+      Innumber == 0 && Escaped == 0) {
+    if (Inquote != 0)
+      n = stopspan(in->ptr, in->end, Inquote, '\\', '\n');
+    else
+      n = otherspan(in->ptr, in->end, "/\"'\\\n");
+    Spanstart = in->ptr;
+    Spanfile = 1;
+  }
+  *start = Spanstart;
+  return (n);
+}
+
+// The scanner has used the first n characters of the
+// span. Move past them as cppgetc() would have done
+void cpptake(int n) {
+  int i;
+
+  if (n == 0)
+    return;
+  if (Spanfile)
+    Input->ptr = Input->ptr + n;
+  else
+    Outpos = Outpos + n;
+  Lastc = Spanstart[n - 1] & 0xff;
+  Lastsent = Lastc;
+  for (i = 0; i < n; i++)
+    if (Spanstart[i] != ' ' && Spanstart[i] != '\t' &&
+	Spanstart[i] != '\r' && Spanstart[i] != '\f') {
+      notguarded();
+      break;
+    }
+}
+#endif
+
+// Add a directory to search for include files
+void cppinclude(char *dir) {
+  if (Nincdirs == MAXINCDIRS)
+    cppfatal("Too many include directories");
+  Incdir[Nincdirs] = dir;
+  Nincdirs++;
+}
+
+// Define a macro given as name or name=value
+void cppdefine(char *def) {
+  int i;
+
+  for (i = 0; def[i] != 0 && def[i] != '='; i++) {
+    if (i >= CPPLINELEN - 4)
+      cppfatal("Pre-processor definition too long");
+    Dline[i] = def[i];
+  }
+  Dline[i] = 0;
+  if (def[i] == '=') {
+    strcat(Dline, " ");
+    if (strlen(Dline) + strlen(def + i + 1) >= CPPLINELEN)
+      cppfatal("Pre-processor definition too long");
+    strcat(Dline, def + i + 1);
+  } else
+    strcat(Dline, " 1");
+  Dp = Dline;
+  define();
+}
+
+// Start pre-processing the named C file
+void cppopen(char *name) {
+  pushfile(strdup(name));
+}
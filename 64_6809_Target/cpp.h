@@ -0,0 +1,12 @@
+/* cpp.c */
+int cppgetc(void);
+void cppinclude(char *dir);
+void cppdefine(char *def);
+void cppopen(char *name);
+#ifdef SCANBUFSIZE
+int cppspan(char **start);
+void cpptake(int n);
+#endif
+
+/* scan.c */
+void setfileline(char *name, int line);
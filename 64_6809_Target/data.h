@@ -12,6 +12,7 @@ extern_ struct symtable *Functionid; 	// Symbol ptr of the current function
 extern_ FILE *Infile;		     	// Input and output files
 extern_ FILE *Outfile;
 extern_ FILE *Symfile;			// Symbol table file
+extern_ FILE *Symidxfile;		// Symbol table index file
 extern_ FILE *Idxfile;			// AST offset index file
 extern_ char *Infilename;		// Name of file we are parsing
 extern_ struct token Token;		// Last token scanned
@@ -208,7 +208,9 @@ static int is_new_symbol(struct symtable *sym, int class,
       fatals("Type mismatch between global/extern", sym->name);
 
     // If we get to here, the types match, so mark the symbol
-    // as global
+    // as global. If it has already been written
+    // to the symbol file, it must be written again
+    if (sym->class != V_GLOBAL) sym->st_changed = 1;
     sym->class = V_GLOBAL;
     // Return that symbol is not new
     return (0);
@@ -382,7 +384,7 @@ static struct symtable *array_declaration(char *varname, int type,
 
     // Zero any unused elements in the initlist.
     // Attach the list to the symbol table entry
-    for (j = i; j < sym->nelems; j++)
+    for (j = i; j < nelems; j++)
       initlist[j] = 0;
 
     if (i > nelems)
@@ -869,6 +871,10 @@ void global_declarations(void) {
 
   // Loop parsing one declaration list until the end of file
   while (Token.token != T_EOF) {
+#ifdef PCHFILES
+    // Save the precompiled header once the headers are parsed
+    savePch();
+#endif
     declaration_list(&ctype, V_GLOBAL, T_SEMI, T_EOF, &unused);
 
     // Skip any separating semicolons
@@ -10,6 +10,15 @@ enum {
   TEXTLEN = 512			// Length of identifiers in input
 };
 
+// Varints are built and taken apart as unsigned values. Our own
+// compiler has no unsigned types, but its int arithmetic wraps
+// and its >> is a logical shift, so an int does the same job
+#ifdef __GNUC__
+typedef unsigned int uvar;
+#else
+typedef int uvar;
+#endif
+
 // Commands and default filenames
 #define AOUT "a.out"
 #define ASCMD "as6809 -o "
@@ -49,7 +58,13 @@ enum {
   T_ARROW, T_COLON, T_ELLIPSIS, T_CHARLIT,      // 63
 
   // Misc
-  T_FILENAME, T_LINENUM				// 67
+  T_FILENAME, T_LINENUM,			// 67
+
+  // Identifiers in an interned token stream, see scan.c
+  T_IDDEF, T_IDREF,				// 69
+
+  // Line number changes in the token stream, see scan.c
+  T_LINEINC, T_LINEADV				// 71
 };
 
 // Token structure
@@ -114,6 +129,8 @@ struct symtable {
 #define has_ellipsis size
   int nelems;			// Functions: # params. Arrays: # elements.
   int st_hasaddr;		// For locals, 1 if any A_ADDR operation
+  int st_lastuse;		// Symbol cache epoch when last used
+  int st_changed;		// Changed since written to the symbol file
 #define st_endlabel st_posn	// For functions, the end label
 #define st_label st_posn	// For string literals, the associated label
   int st_posn;			// For locals, the negative offset
@@ -125,6 +142,34 @@ struct symtable {
   struct symtable *member;	// List of member of struct, union or enum.
 };				// For functions, list of parameters & locals.
 
+// The symbol table file starts with SYMHDRLEN bytes: the letters
+// "wsy" and the version number of the record format. Each record
+// is the symbol's type, class*16 + stype and SF_ flags, then its
+// id, ctypeid, size, nelems and st_posn, all as varints. Then come
+// the length and NUL-terminated name, the nelems initial values
+// and the number of member records which follow this one.
+#define SYMVERSION 2
+#define SYMHDRLEN 4
+
+// The records are kept in NSYMSECT sections, one after the other.
+// After the header is a directory of SYMDIRLEN bytes which holds
+// the length of each section as four bytes, lowest byte first.
+// The symbol index file gives a symbol's offset within its section
+// times NSYMSECT, plus the section number.
+#define NSYMSECT 4
+#define SYMDIRLEN 16
+
+#define SS_FUNCS	0	// Functions with their params and locals,
+				// and any symbol not in the other sections
+#define SS_TYPES	1	// Structs, unions, enums and typedefs
+#define SS_GLOBALS	2	// Global and static variables and arrays
+#define SS_STRLITS	3	// String literals
+
+#define SF_NAME		1	// The record has a name
+#define SF_INIT		2	// The record has an initialisation list
+#define SF_HASADDR	4	// st_hasaddr is set
+#define SF_MEMBS	8	// Member records follow this one
+
 // Abstract Syntax Tree structure
 struct ASTnode {
   int op;			// "Operation" to be performed on this tree
@@ -147,6 +192,34 @@ struct ASTnode {
   int linenum;			// Line number from where this node comes
 };
 
+// The AST file starts with ASTHDRLEN bytes: the letters "wat"
+// and the version number of the record format. Each node record
+// is op*2 + rvalue, the AF_ flags, the type and the nodeid, all
+// as varints. The other fields follow only when their flag is set:
+// the left, mid and right ids as signed deltas from the nodeid,
+// the symid, the length and NUL-terminated name, the a_intvalue
+// and the linenum.
+#define ASTVERSION 1
+#define ASTHDRLEN 4
+
+#define AF_LEFT		1	// The node has a left child
+#define AF_MID		2	// The node has a mid child
+#define AF_RIGHT	4	// The node has a right child
+#define AF_SYMID	8	// The node has a symid
+#define AF_NAME		16	// The node has a name
+#define AF_VALUE	32	// a_intvalue is not zero
+#define AF_LINE		64	// The node has a linenum
+
+// The function table in the AST index file has one of these
+// for each function: the offset of its A_FUNCTION node, the
+// offset just past its last node and its range of node ids.
+struct ASTfunc {
+  long offset;
+  long end;
+  int loid;
+  int hiid;
+};
+
 enum {
   NOREG = -1,			// Use NOREG when the AST generation
   				// functions have no register to return
@@ -32,44 +32,81 @@ char *fgetstr(char *s, size_t count, FILE * f) {
   return(ferror(f) ? (char *) NULL : ret);
 }
 
+// Read a varint from the in FILE. Return -1 on EOF.
+int getvar(FILE *in) {
+  uvar val = 0;
+  uvar part;
+  int shift = 0;
+  int ch;
+
+  while (1) {
+    ch = fgetc(in);
+    if (ch == EOF) return (-1);
+    part = ch & 127;
+    val = val + (part << shift);
+    if ((ch & 128) == 0) break;
+    shift = shift + 7;
+  }
+  return (val);
+}
+
+// Read a zigzag-encoded signed varint from the in FILE
+int getsvar(FILE *in) {
+  uvar val;
+
+  val = getvar(in);
+  return ((val >> 1) ^ -(val & 1));
+}
+
 // Read one symbol in. Return -1 if none.
 int deserialiseSym(struct symtable *sym, FILE *in) {
   struct symtable *memb, *last;
+  int flags, nmembs, i;
 
-  // Read one symbol struct in from in
-  if (fread(sym, sizeof(struct symtable), 1, in)!=1)
+  // Read the fixed fields of one symbol record in from in
+  sym->type = getvar(in);
+  if (sym->type == -1)
     return(-1);
-
-  // If the type is P_NONE, skip this one and read in
-  // another symbol. This marks the division between
-  // AST trees
-  if (sym->type==P_NONE) {
-    // Debug: printf("Skipping a P_NONE symbol\n");
-    if (fread(sym, sizeof(struct symtable), 1, in)!=1)
-      return(-1);
-  }
-
-  // Get the symbol name
-  if (sym->name != NULL) {
+  i = getvar(in);
+  sym->class = i >> 4;
+  sym->stype = i & 15;
+  flags = getvar(in);
+  sym->id = getvar(in);
+  sym->ctypeid = getvar(in);
+  sym->size = getsvar(in);
+  sym->nelems = getsvar(in);
+  sym->st_posn = getsvar(in);
+  sym->st_hasaddr = 0;
+  if (flags & SF_HASADDR) sym->st_hasaddr = 1;
+  sym->name = NULL;
+  sym->initlist = NULL;
+  sym->member = NULL;
+  sym->next = NULL;
+
+  // Get the symbol name, skipping its length
+  if (flags & SF_NAME) {
+    getvar(in);
     fgetstr(Text, TEXTLEN + 1, in);
     sym->name= strdup(Text);
   }
 
   // Get any initial values
-  if (sym->initlist != NULL) {
+  if (flags & SF_INIT) {
     sym->initlist= (int *)malloc(sym->nelems* sizeof(int));
-    fread(sym->initlist, sizeof(int), sym->nelems, in);
+    for (i=0; i < sym->nelems; i++)
+      sym->initlist[i]= getsvar(in);
   }
 
   // If there are any members, read them in
-  if (sym->member != NULL) {
-    sym->member= last= NULL;
+  if (flags & SF_MEMBS) {
+    nmembs = getvar(in);
+    last= NULL;
 
-    while (1) {
+    for (i=0; i < nmembs; i++) {
       // Create an empty symbol struct
       memb= (struct symtable *)malloc(sizeof(struct symtable));
 
-      // Read the struct in from the in file
+      // Read the member in from the in file
       // Stop if no symbols in the file
       if (deserialiseSym(memb, in)== -1) return(0);
 
@@ -80,9 +117,6 @@ int deserialiseSym(struct symtable *sym, FILE *in) {
 	last->next= memb;
         last= memb;
       }
-
-      // Stop if there is no next member
-      if (memb->next == NULL) return(0);
     }
   }
 
@@ -224,6 +258,7 @@ void dumptable(struct symtable *head, int indent) {
 int main(int argc, char **argv) {
   FILE *in;
   struct symtable sym;
+  int i;
 
   if (argc !=2) {
     fprintf(stderr, "Usage: %s symbolfile\n", argv[0]); exit(1);
@@ -234,6 +269,18 @@ int main(int argc, char **argv) {
     fprintf(stderr, "Unable to open %s\n", argv[1]); exit(1);
   }
 
+  // Check the header for the record format version
+  if (fgetc(in)!='w' || fgetc(in)!='s' || fgetc(in)!='y' ||
+      fgetc(in)!=SYMVERSION) {
+    fprintf(stderr, "%s is not a version %d symbol file\n",
+						argv[1], SYMVERSION);
+    exit(1);
+  }
+
+  // Skip the directory. The sections follow each other
+  for (i= 0; i < SYMDIRLEN; i++)
+    fgetc(in);
+
   while (1) {
     if (deserialiseSym(&sym, in)== -1) break;
     dumpsym(&sym, 0);
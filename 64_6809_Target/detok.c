@@ -30,6 +30,25 @@ char *fgetstr(char *s, size_t count, FILE * f) {
   return(ferror(f) ? (char *) NULL : ret);
 }
 
+// Read a varint from the f FILE
+int fgetvar(FILE * f) {
+  int ch, part, val = 0, shift = 0;
+
+  while ((ch = getc(f)) != EOF) {
+    part = ch & 127;
+    val = val + (part << shift);
+    if ((ch & 128) == 0)
+      break;
+    shift = shift + 7;
+  }
+  return (val);
+}
+
+// The names of the identifiers
+// in an interned token stream
+char **Idname = NULL;
+int Nidname = 0;
+
 int main(int argc, char **argv) {
   FILE *in;
   int token;
@@ -68,10 +87,31 @@ int main(int argc, char **argv) {
       fread(&intval, sizeof(int), 1, in);
       printf("%02X: linenum %d\n", token, intval);
       break;
+    case T_LINEINC:
+      printf("%02X: linenum +1\n", token);
+      break;
+    case T_LINEADV:
+      intval = fgetc(in);
+      printf("%02X: linenum +%d\n", token, intval);
+      break;
     case T_IDENT:
       fgetstr(Text, TEXTLEN + 1, in);
       printf("%02X: %s\n", token, Text);
       break;
+    case T_IDDEF:
+      intval = fgetvar(in);
+      fgetstr(Text, TEXTLEN + 1, in);
+      printf("%02X: %s (id %d)\n", token, Text, intval);
+      Idname = (char **) realloc(Idname, (Nidname + 1) * sizeof(char *));
+      Idname[Nidname++] = strdup(Text);
+      break;
+    case T_IDREF:
+      intval = fgetvar(in);
+      if (intval < Nidname)
+	printf("%02X: %s (id %d)\n", token, Idname[intval], intval);
+      else
+	printf("%02X: unknown id %d\n", token, intval);
+      break;
     default:
       printf("%02X: %s\n", token, Tstring[token]);
     }
@@ -136,7 +136,7 @@ void dumpAST(struct ASTnode *n, int label, int level) {
   if (nleft) dumpAST(nleft, NOLABEL, level + 2);
   if (nmid) dumpAST(nmid, NOLABEL, level + 2);
   if (nright) dumpAST(nright, NOLABEL, level + 2);
-  if (n->name!=NULL) free(n->name);
+  if (n->name!=NULL) mfreestr(n->name);
   free(n);
 }
 
@@ -156,9 +156,20 @@ int main(int argc, char **argv) {
   if (Infile==NULL) {
     fprintf(stderr, "Unable to open %s\n", argv[fileid]); exit(1);
   }
+  if (checkASTfile()==0) {
+    fprintf(stderr, "%s is not a version %d AST file\n",
+					argv[fileid], ASTVERSION);
+    exit(1);
+  }
 
   Idxfile= tmpfile();
+#ifdef MMAPFILES
+  mapfile(Infile);
+#endif
   mkASTidxfile();               // Build the AST index offset file
+#ifdef MMAPFILES
+  mapfile(Idxfile);
+#endif
 
   // Loop reading the next function's top node in from file
   while (1) {
@@ -20,6 +20,22 @@ int genlabel(void) {
   return (labelid++);
 }
 
+#ifdef FUNCCACHE
+// Get and set the next label number, so that
+// a cached function can use the same labels
+int getlabelid(void) {
+  return (labelid);
+}
+
+void setlabelid(int id) {
+  labelid = id;
+}
+
+// When Strlog isn't NULL, we write each string literal's label
+// and value to it, so that a cached function can make them again
+FILE *Strlog = NULL;
+#endif
+
 void genfreeregs(int keepreg) {
   cgfreeallregs(keepreg);
 }
@@ -783,5 +799,9 @@ int genglobstr(char *strvalue) {
   cglitseg();
   cgglobstr(l, strvalue);
   cgtextseg();
+#ifdef FUNCCACHE
+  if (Strlog != NULL)
+    fprintf(Strlog, "S %d %d\n%s\n", l, (int) strlen(strvalue), strvalue);
+#endif
   return (l);
 }
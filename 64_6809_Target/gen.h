@@ -6,3 +6,8 @@ void genpostamble();
 void genfreeregs(int keepreg);
 void genglobsym(struct symtable *node);
 int genglobstr(char *strvalue);
+#ifdef FUNCCACHE
+int getlabelid(void);
+void setlabelid(int id);
+extern FILE *Strlog;
+#endif
@@ -10,5 +10,6 @@ void *calloc(int nmemb, int size);
 void *realloc(void *ptr, int size);
 int system(char *command);
 int abs(int j);
+int atoi(char *nptr);
 
 #endif	// _STDLIB_H_
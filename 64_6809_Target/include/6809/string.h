@@ -10,5 +10,6 @@ char *strcpy(char *dst, char *src);
 char *strerror(int errnum);
 int strlen(char *s);
 char *strcat(char *dst, char *src);
+void *memcpy(void *dst, void *src, size_t n);
 
 #endif	// _STRING_H_
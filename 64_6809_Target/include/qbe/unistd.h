@@ -5,6 +5,9 @@ void _exit(int status);
 int unlink(char *pathname);
 int fork(void);
 int execvp(char *file, char **argv);
+int pipe(int *pipefd);
+int dup2(int oldfd, int newfd);
+int close(int fd);
 int getopt(int argc, char **argv, char *optstring);
 extern char *optarg;
 extern int optind, opterr, optopt;
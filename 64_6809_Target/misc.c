@@ -2,7 +2,12 @@
 #include <unistd.h>
 #include "defs.h"
 #include "data.h"
+#include "misc.h"
 #include "parse.h"
+#ifdef MMAPFILES
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 // Miscellaneous functions
 // Copyright (c) 2019 Warren Toomey, GPL3
@@ -53,3 +58,326 @@ char *fgetstr(char *s, size_t count, FILE * f) {
   *s = 0;
   return(ferror(f) ? (char *) NULL : ret);
 }
+
+// Write a value to the f FILE as a varint:
+// seven bits per byte, lowest bits first, with
+// the top bit set on all but the last byte.
+// The value's bits are taken as unsigned
+void fputvar(int val, FILE *f) {
+  uvar v = val;
+
+  while ((v & ~127) != 0) {
+    fputc((v & 127) + 128, f);
+    v = v >> 7;
+  }
+  fputc(v, f);
+}
+
+// Read a varint from the f FILE and return it.
+// Return -1 on EOF.
+int fgetvar(FILE *f) {
+  uvar val = 0;
+  uvar part;
+  int shift = 0;
+  char ch;
+
+  while (1) {
+    if (mread(&ch, 1, 1, f) != 1) return (-1);
+    part = ch & 127;
+    val = val + (part << shift);
+    if ((ch & 128) == 0) break;
+    shift = shift + 7;
+  }
+  return (val);
+}
+
+// Zigzag encode a value which may be negative so that
+// small negative values stay short as varints: 0, -1,
+// 1, -2 ... become 0, 1, 2, 3 ... This is done on the
+// unsigned bits, so that no value can overflow
+uvar zigzag(int val) {
+  uvar v = val;
+
+  v = v << 1;
+  if (val < 0) v = ~v;
+  return (v);
+}
+
+// Undo the zigzag encoding
+int unzigzag(uvar v) {
+  return ((v >> 1) ^ -(v & 1));
+}
+
+// Write a value which may be negative as a varint
+void fputsvar(int val, FILE *f) {
+  fputvar(zigzag(val), f);
+}
+
+// Read a signed varint from the f FILE and return it
+int fgetsvar(FILE *f) {
+  return (unzigzag(fgetvar(f)));
+}
+
+#ifdef FUNCCACHE
+// Add len bytes from buf to a 64-bit FNV-1a hash
+unsigned long long fnvhash(unsigned long long hash, void *buf, int len) {
+  unsigned char *s = (unsigned char *) buf;
+  int i;
+
+  for (i = 0; i < len; i++) {
+    hash ^= s[i];
+    hash *= 1099511628211ULL;
+  }
+  return (hash);
+}
+
+// Add an integer to a hash
+unsigned long long fnvint(unsigned long long hash, int val) {
+  return (fnvhash(hash, &val, sizeof(int)));
+}
+#endif
+
+#ifdef SCANBUFSIZE
+// On hosts, the scanner and the built-in cpp look at their input
+// eight bytes at a time to find the end of a run of blanks, of an
+// identifier or of the characters up to one of a few stop bytes.
+// Each byte of a word is classified at once: these give a word
+// with the top bit set in each byte which matches
+#define ONES  0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+
+// Bytes of w which are zero
+static unsigned long long zerobytes(unsigned long long w) {
+  return (~(((w & ~HIGHS) + ~HIGHS) | w) & HIGHS);
+}
+
+// Bytes of w which are the character c
+static unsigned long long matchbytes(unsigned long long w, int c) {
+  return (zerobytes(w ^ (ONES * (c & 0xff))));
+}
+
+// Bytes of w from lo to hi. The bytes must all be below 0x80
+static unsigned long long rangebytes(unsigned long long w, int lo, int hi) {
+  return ((w + ONES * (0x80 - lo)) & ~(w + ONES * (0x7f - hi)) & HIGHS);
+}
+
+// Given a non-zero result from the above, return
+// the position of the first byte which matched
+static int firstbyte(unsigned long long mask) {
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  return (__builtin_ctzll(mask) >> 3);
+#else
+  char *p = (char *) &mask;
+  int i;
+
+  for (i = 0; (p[i] & 0x80) == 0; i++);
+  return (i);
+#endif
+}
+
+// Return the number of blanks, i.e. spaces,
+// tabs, '\r' and '\f', from p up to end
+int blankspan(char *p, char *end) {
+  unsigned long long w, mask;
+  char *start = p;
+
+  for (; end - p >= 8; p += 8) {
+    memcpy(&w, p, 8);
+    mask = matchbytes(w, ' ') | matchbytes(w, '\t') |
+	   matchbytes(w, '\r') | matchbytes(w, '\f');
+    if (mask != HIGHS)
+      return (p - start + firstbyte(~mask & HIGHS));
+  }
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\f'))
+    p++;
+  return (p - start);
+}
+
+// Return the number of identifier characters from p up to end
+int identspan(char *p, char *end) {
+  unsigned long long w, low, mask;
+  char *start = p;
+
+  for (; end - p >= 8; p += 8) {
+    memcpy(&w, p, 8);
+    low = w & ~HIGHS;
+    mask = rangebytes(low | (ONES * 0x20), 'a', 'z') |
+	   rangebytes(low, '0', '9') | matchbytes(w, '_');
+    mask = (~mask | w) & HIGHS;		// Bytes not in an identifier
+    if (mask != 0)
+      return (p - start + firstbyte(mask));
+  }
+  while (p < end && (isalnum(*p & 0xff) || *p == '_'))
+    p++;
+  return (p - start);
+}
+
+// Return the number of characters from p up to end which
+// are not in an identifier and are not in the stops string
+int otherspan(char *p, char *end, char *stops) {
+  unsigned long long w, low, mask;
+  char *start = p;
+  char *s;
+
+  for (; end - p >= 8; p += 8) {
+    memcpy(&w, p, 8);
+    low = w & ~HIGHS;
+    mask = rangebytes(low | (ONES * 0x20), 'a', 'z') |
+	   rangebytes(low, '0', '9') | matchbytes(w, '_');
+    mask = mask & ~w;			// Bytes in an identifier
+    for (s = stops; *s; s++)
+      mask = mask | matchbytes(w, *s);
+    mask = mask & HIGHS;
+    if (mask != 0)
+      return (p - start + firstbyte(mask));
+  }
+  for (; p < end && !isalnum(*p & 0xff) && *p != '_'; p++)
+    for (s = stops; *s; s++)
+      if (*p == *s)
+	return (p - start);
+  return (p - start);
+}
+
+// Return the number of characters from p up
+// to end which come before any a, b or c
+int stopspan(char *p, char *end, int a, int b, int c) {
+  unsigned long long w, mask;
+  char *start = p;
+
+  for (; end - p >= 8; p += 8) {
+    memcpy(&w, p, 8);
+    mask = matchbytes(w, a) | matchbytes(w, b) | matchbytes(w, c);
+    if (mask != 0)
+      return (p - start + firstbyte(mask));
+  }
+  while (p < end && *p != (char) a && *p != (char) b && *p != (char) c)
+    p++;
+  return (p - start);
+}
+#endif
+
+#ifdef MMAPFILES
+// On hosts with mmap(), we can map the symbol, AST and
+// index files into memory once they have been written.
+// For each mapped file we keep the FILE pointer, the
+// start and size of the mapping and our position in it.
+#define MAXMAPS 4
+
+static struct mapping {
+  FILE *f;
+  char *base;
+  long size;
+  long posn;
+} Maps[MAXMAPS];
+static int Nmaps = 0;
+
+// Memory map the file f. From now on, the functions below
+// read f through the mapping. Return 1 if the file was
+// mapped, or 0 if we have to keep reading it with stdio.
+int mapfile(FILE *f) {
+  struct stat sb;
+  char *base;
+
+  if (Nmaps == MAXMAPS) return (0);
+  fflush(f);
+  if (fstat(fileno(f), &sb) == -1 || sb.st_size == 0) return (0);
+  base = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+  if (base == MAP_FAILED) return (0);
+
+  Maps[Nmaps].f = f;
+  Maps[Nmaps].base = base;
+  Maps[Nmaps].size = sb.st_size;
+  Maps[Nmaps].posn = ftell(f);
+  Nmaps++;
+  return (1);
+}
+
+// Return the mapping for the file f, or NULL if none
+static struct mapping *findmap(FILE *f) {
+  int i;
+
+  for (i = 0; i < Nmaps; i++)
+    if (Maps[i].f == f) return (&Maps[i]);
+  return (NULL);
+}
+
+// Return true if s points into one of the mappings
+static int inmapping(char *s) {
+  int i;
+
+  for (i = 0; i < Nmaps; i++)
+    if (s >= Maps[i].base && s < Maps[i].base + Maps[i].size)
+      return (1);
+  return (0);
+}
+
+// fread() replacement. Like fread(), only whole items are read
+size_t mread(void *ptr, size_t size, size_t nmemb, FILE *f) {
+  struct mapping *m = findmap(f);
+  size_t avail;
+
+  if (m == NULL) return (fread(ptr, size, nmemb, f));
+  avail = (m->size - m->posn) / size;
+  if (nmemb > avail) nmemb = avail;
+  memcpy(ptr, m->base + m->posn, size * nmemb);
+  m->posn += size * nmemb;
+  return (nmemb);
+}
+
+// fseek() replacement
+int mseek(FILE *f, long offset, int whence) {
+  struct mapping *m = findmap(f);
+
+  if (m == NULL) return (fseek(f, offset, whence));
+  if (whence == SEEK_CUR) offset += m->posn;
+  if (whence == SEEK_END) offset += m->size;
+  if (offset < 0) return (-1);
+  m->posn = offset;
+  return (0);
+}
+
+// ftell() replacement
+long mtell(FILE *f) {
+  struct mapping *m = findmap(f);
+
+  if (m == NULL) return (ftell(f));
+  return (m->posn);
+}
+
+// fgetstr() replacement. For a mapped file, return
+// a pointer to the NUL-terminated string in place
+// and don't copy it into s. Return NULL at EOF.
+char *mgetstr(char *s, size_t count, FILE *f) {
+  struct mapping *m = findmap(f);
+  char *str;
+  long len;
+
+  if (m == NULL) return (fgetstr(s, count, f));
+  if (m->posn >= m->size) return (NULL);
+
+  // If the string isn't NUL-terminated before
+  // the end of the file, copy what there is
+  str = m->base + m->posn;
+  len = strnlen(str, m->size - m->posn);
+  if (len == m->size - m->posn) {
+    if (len >= count) len = count - 1;
+    memcpy(s, str, len); s[len] = 0;
+    m->posn = m->size;
+    return (s);
+  }
+  m->posn += len + 1;
+  return (str);
+}
+
+// Return a copy of the string s that we can keep.
+// Strings in a mapping are already permanent.
+char *mkeepstr(char *s) {
+  if (inmapping(s)) return (s);
+  return (strdup(s));
+}
+
+// Free a string unless it is in a mapping
+void mfreestr(char *s) {
+  if (!inmapping(s)) free(s);
+}
+#endif
@@ -4,3 +4,43 @@ void fatals(char *s1, char *s2);
 void fatald(char *s, int d);
 void fatalc(char *s, int c);
 char *fgetstr(char *s, size_t count, FILE * f);
+void fputvar(int val, FILE *f);
+int fgetvar(FILE *f);
+void fputsvar(int val, FILE *f);
+int fgetsvar(FILE *f);
+uvar zigzag(int val);
+int unzigzag(uvar v);
+
+#ifdef FUNCCACHE
+#define FNVINIT 14695981039346656037ULL
+unsigned long long fnvhash(unsigned long long hash, void *buf, int len);
+unsigned long long fnvint(unsigned long long hash, int val);
+#endif
+
+// Finding runs of characters a word at a time
+#ifdef SCANBUFSIZE
+int blankspan(char *p, char *end);
+int identspan(char *p, char *end);
+int otherspan(char *p, char *end, char *stops);
+int stopspan(char *p, char *end, int a, int b, int c);
+#endif
+
+// Reading the symbol, AST and index files. When built with
+// MMAPFILES, a file given to mapfile() is read through a
+// memory mapping and its strings are returned in place.
+#ifdef MMAPFILES
+int mapfile(FILE *f);
+size_t mread(void *ptr, size_t size, size_t nmemb, FILE *f);
+int mseek(FILE *f, long offset, int whence);
+long mtell(FILE *f);
+char *mgetstr(char *s, size_t count, FILE *f);
+char *mkeepstr(char *s);
+void mfreestr(char *s);
+#else
+#define mread fread
+#define mseek fseek
+#define mtell ftell
+#define mgetstr fgetstr
+#define mkeepstr strdup
+#define mfreestr free
+#endif
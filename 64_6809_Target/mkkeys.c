@@ -0,0 +1,87 @@
+#include "defs.h"
+
+// Keyword table generator for the scanner
+// Copyright (c) 2024 Warren Toomey, GPL3
+
+// We take the keywords from T_VOID to T_STATIC in Tstring[] and
+// look for a hash on an identifier's length and its first and
+// last characters which puts each keyword in a slot of its own.
+// We write out the table and the hash as keywords.h, so that
+// keyword() in scan.c needs only one strcmp() per identifier.
+// If a new keyword breaks the hash, we search for another one,
+// and fail the build if there isn't one.
+
+#define FIRSTKEY T_VOID
+#define LASTKEY T_STATIC
+#define MAXSLOTS 256		// Largest table we will try
+#define MAXMULT 32		// Largest multiplier we will try
+
+extern char *Tstring[];
+
+int Slot[MAXSLOTS];		// Token in each slot, or 0
+
+// The hash. This must match the keyhash() we write out
+int keyhash(char *s, int a, int b, int size) {
+  int len = strlen(s);
+  return ((s[0] * a + s[len - 1] * b + len) % size);
+}
+
+// Try the hash with these multipliers and table
+// size. Return 1 if each keyword gets its own slot
+int tryhash(int a, int b, int size) {
+  int t, h;
+
+  for (h = 0; h < size; h++)
+    Slot[h] = 0;
+  for (t = FIRSTKEY; t <= LASTKEY; t++) {
+    h = keyhash(Tstring[t], a, b, size);
+    if (Slot[h] != 0)
+      return (0);
+    Slot[h] = t;
+  }
+  return (1);
+}
+
+int main(int argc, char **argv) {
+  int a, b, size, h, t, len;
+  int minlen = TEXTLEN, maxlen = 0;
+
+  // Find the smallest table that
+  // we can make a perfect hash for
+  for (size = LASTKEY - FIRSTKEY + 1; size <= MAXSLOTS; size++)
+    for (a = 1; a <= MAXMULT; a++)
+      for (b = 1; b <= MAXMULT; b++)
+	if (tryhash(a, b, size))
+	  goto found;
+
+  fprintf(stderr, "%s: no perfect hash for the keywords\n", argv[0]);
+  exit(1);
+
+found:
+  for (t = FIRSTKEY; t <= LASTKEY; t++) {
+    len = strlen(Tstring[t]);
+    if (len < minlen) minlen = len;
+    if (len > maxlen) maxlen = len;
+  }
+
+  printf("// Keyword table for scan.c, made by mkkeys. Do not edit\n\n");
+  printf("#define KEYMINLEN %d\n", minlen);
+  printf("#define KEYMAXLEN %d\n", maxlen);
+  printf("#define keyhash(s, len) ");
+  printf("(((s)[0] * %d + (s)[(len) - 1] * %d + (len)) %% %d)\n\n", a, b, size);
+
+  // Our compiler doesn't allow a comma
+  // after the last initialiser
+  printf("static char *Keyname[] = {\n");
+  for (h = 0; h < size; h++)
+    printf("  \"%s\"%s\n", Slot[h] ? Tstring[Slot[h]] : "",
+	   h < size - 1 ? "," : "");
+  printf("};\n\n");
+
+  printf("static int Keytoken[] = {\n");
+  for (h = 0; h < size; h++)
+    printf("  %d%s\n", Slot[h], h < size - 1 ? "," : "");
+  printf("};\n");
+  exit(0);
+  return (0);
+}
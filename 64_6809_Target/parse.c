@@ -7,6 +7,10 @@
 #include "misc.h"
 #include "sym.h"
 #include "tree.h"
+#ifdef PCHFILES
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 // C parser front-end.
 // Copyright (c) 2023 Warren Toomey, GPL3
@@ -37,6 +41,330 @@ void print_token(struct token *t) {
 #endif
 
 
+#ifdef TOKINTERN
+// On hosts, the scanner sends the first use of each identifier as
+// T_IDDEF with an id and the name, and the later uses as T_IDREF
+// with only the id. We keep the name of each id in Idname[]
+static char **Idname = NULL;
+static int Nidname = 0;		// Number of ids with a name
+static int Maxidname = 0;	// Size of Idname[]
+
+// Give the next id its name. We may see an id's T_IDDEF again
+// when scan() re-reads the header tokens, so ignore known ids
+static void defineident(int id, char *name) {
+  if (id < Nidname) return;
+  if (id != Nidname)
+    fatald("Bad identifier id in the token stream", id);
+  if (Nidname == Maxidname) {
+    Maxidname = (Maxidname == 0) ? 1024 : Maxidname * 2;
+    Idname = (char **) realloc(Idname, Maxidname * sizeof(char *));
+    if (Idname == NULL)
+      fatal("Unable to malloc the identifier table");
+  }
+  Idname[Nidname++] = strdup(name);
+}
+#endif
+
+#ifdef PCHFILES
+// On the host, the parser can keep precompiled headers. The
+// headers which a C file includes before its first declaration
+// are usually the same in many C files. readHeaders() reads
+// their tokens, and the markers and the first token which follow
+// them, into Tokbuf. scan() takes its tokens from Tokbuf before
+// stdin.
+//
+// The header tokens without the line and filename markers, along
+// with this parser's identity, name a precompiled header file.
+// If it exists, we load the symbol state from it and skip the
+// header tokens. Otherwise, savePch() writes the state out once
+// global_declarations() has parsed the headers. We know that a
+// token comes from a header when its filename ends in ".h".
+#define PCHVERSION 1
+static char *Tokbuf = NULL;	// Buffered token stream
+static int Toklen = 0;		// Number of bytes in Tokbuf
+static int Tokmax = 0;		// Size of Tokbuf
+static int Tokpos = 0;		// Position of the next byte to scan
+static int Tokstdin = 0;	// Set once we read from stdin again
+static int Tokbound;		// Offset of the first token after the headers
+static char *Hdrkey = NULL;	// The header tokens without the markers
+static int Hdrkeylen = 0;
+static int Hdrkeymax = 0;
+static int Hdrline;		// Line number and filename
+static char *Hdrname = NULL;	// at Tokbound
+static char *Pchname = NULL;	// Precompiled header to write, or NULL
+
+// Append a byte to a growable buffer
+static void appendbyte(char **buf, int *len, int *max, int c) {
+  if (*len == *max) {
+    *max = (*max == 0) ? 4096 : *max * 2;
+    *buf = (char *) realloc(*buf, *max);
+    if (*buf == NULL)
+      fatal("Unable to malloc the token buffer");
+  }
+  (*buf)[*len] = (char) c;
+  *len = *len + 1;
+}
+
+// Get the next byte of the token stream
+static int tokgetc(void) {
+  if (Tokpos < Toklen)
+    return (Tokbuf[Tokpos++] & 0xff);
+  Tokstdin = 1;
+  return (fgetc(stdin));
+}
+
+// Read an int from the token stream
+static void tokgetint(int *val) {
+  char *p = (char *) val;
+  int i;
+
+  for (i = 0; i < sizeof(int); i++)
+    p[i] = (char) tokgetc();
+}
+
+// Read a NUL-terminated string of at most
+// count-1 characters from the token stream
+static void tokgetstr(char *s, int count) {
+  int c, i = 0;
+
+  while ((c = tokgetc()) != EOF && c != 0)
+    if (i < count - 1) s[i++] = (char) c;
+  s[i] = 0;
+}
+
+// Read a byte from stdin into Tokbuf
+static int readtokbyte(void) {
+  int c = fgetc(stdin);
+
+  if (c != EOF) appendbyte(&Tokbuf, &Toklen, &Tokmax, c);
+  return (c);
+}
+
+#ifdef TOKINTERN
+// Read a varint from stdin into Tokbuf
+static int readtokvar(void) {
+  int c, val = 0, shift = 0;
+
+  while ((c = readtokbyte()) != EOF) {
+    val = val + ((c & 127) << shift);
+    if ((c & 128) == 0) break;
+    shift = shift + 7;
+  }
+  return (val);
+}
+#endif
+
+// Read the tokens up to and including the first one which
+// doesn't come from a ".h" file into Tokbuf. Build Hdrkey from
+// the tokens before it, and record the line number and filename
+// at that point. Return 1 if there were header tokens before it,
+// 0 if not or if we reached the end of the token stream
+static int readHeaders(void) {
+  char name[TEXTLEN + 1];
+  int c, i, start, inheader = 0;
+#ifdef TOKINTERN
+  int id;
+#endif
+
+  while (1) {
+    start = Toklen;
+    c = readtokbyte();
+    switch (c) {
+    case EOF:
+      return (0);
+    case T_LINENUM:
+      for (i = 0; i < sizeof(int); i++) readtokbyte();
+      memcpy(&Hdrline, Tokbuf + start + 1, sizeof(int));
+      continue;
+#ifdef TOKLINEDELTA
+    case T_LINEINC:
+      Hdrline++;
+      continue;
+    case T_LINEADV:
+      Hdrline = Hdrline + readtokbyte();
+      continue;
+#endif
+    case T_FILENAME:
+      i = 0;
+      while ((c = readtokbyte()) != EOF && c != 0)
+	if (i < TEXTLEN) name[i++] = (char) c;
+      name[i] = 0;
+      inheader = (i >= 2 && name[i - 2] == '.' && name[i - 1] == 'h');
+      if (Hdrname != NULL) free(Hdrname);
+      Hdrname = strdup(name);
+      continue;
+    case T_INTLIT:
+    case T_CHARLIT:
+      for (i = 0; i < sizeof(int); i++) readtokbyte();
+      break;
+    case T_STRLIT:
+    case T_IDENT:
+      while ((c = readtokbyte()) != EOF && c != 0);
+      break;
+#ifdef TOKINTERN
+    case T_IDREF:
+      readtokvar();
+      break;
+    case T_IDDEF:
+      id = readtokvar();
+      i = 0;
+      while ((c = readtokbyte()) != EOF && c != 0)
+	if (i < TEXTLEN) name[i++] = (char) c;
+      name[i] = 0;
+      defineident(id, name);	// so that we know it after a PCH load
+      break;
+#endif
+    }
+
+    // The first token from the C file ends the headers
+    if (inheader == 0) {
+      Tokbound = start;
+      return (Hdrkeylen != 0);
+    }
+    for (i = start; i < Toklen; i++)
+      appendbyte(&Hdrkey, &Hdrkeylen, &Hdrkeymax, Tokbuf[i]);
+  }
+}
+
+// Add len bytes to a 64-bit FNV-1a hash
+static unsigned long long fnvhash(unsigned long long hash,
+				  char *buf, int len) {
+  int i;
+
+  for (i = 0; i < len; i++) {
+    hash ^= (unsigned char) buf[i];
+    hash *= 1099511628211ULL;
+  }
+  return (hash);
+}
+
+// Write the precompiled header file header
+static void putPchheader(FILE *f) {
+  fputs("wph", f);
+  fputc(PCHVERSION, f);
+  fputc(SYMVERSION, f);
+  fwrite(&Hdrkeylen, sizeof(int), 1, f);
+  fwrite(Hdrkey, 1, Hdrkeylen, f);
+}
+
+// Check the header of a precompiled header file
+// against our header tokens. Return 1 if they match
+static int checkPchheader(FILE *f) {
+  char hdr[5];
+  char *key;
+  int len, ok;
+
+  if (fread(hdr, 1, 5, f) != 5) return (0);
+  if (hdr[0] != 'w' || hdr[1] != 'p' || hdr[2] != 'h') return (0);
+  if (hdr[3] != PCHVERSION || hdr[4] != SYMVERSION) return (0);
+  if (fread(&len, sizeof(int), 1, f) != 1 || len != Hdrkeylen) return (0);
+  key = (char *) malloc(len);
+  if (key == NULL) return (0);
+  ok = fread(key, 1, len, f) == len && !memcmp(key, Hdrkey, len);
+  free(key);
+  return (ok);
+}
+
+// Read the headers at the start of the token stream, and
+// load their precompiled header from the directory if we
+// have it. Otherwise get ready to write it out
+static void startPch(char *dir, char *progname) {
+  unsigned long long hash = 14695981039346656037ULL;
+  struct stat sb;
+  char id[100];
+  char *name;
+  int nextid;
+  FILE *f;
+
+  if (readHeaders() == 0) return;
+
+  // Name the file by a hash of the header tokens
+  // and of the parser, as each target has its own
+  hash = fnvhash(hash, Hdrkey, Hdrkeylen);
+  name = strrchr(progname, '/');
+  name = (name == NULL) ? progname : name + 1;
+  hash = fnvhash(hash, name, strlen(name));
+  if (stat("/proc/self/exe", &sb) == 0) {
+    snprintf(id, sizeof(id), "%lld %lld", (long long) sb.st_size,
+	     (long long) sb.st_mtime);
+    hash = fnvhash(hash, id, strlen(id));
+  }
+  name = (char *) malloc(strlen(dir) + 30);
+  if (name == NULL)
+    fatal("Unable to malloc the precompiled header name");
+  sprintf(name, "%s/%016llx.pch", dir, hash);
+
+  // Load the precompiled header if we have it, and
+  // start scanning at the first token after the headers
+  f = fopen(name, "r");
+  if (f != NULL) {
+    if (checkPchheader(f)) {
+      if (fread(&nextid, sizeof(int), 1, f) != 1)
+	fatal("Unable to load the precompiled header file");
+      setnodeid(nextid);
+      loadSymstate(f);
+      fclose(f);
+      Line = Hdrline;
+      if (Infilename != NULL) free(Infilename);
+      Infilename = strdup(Hdrname);
+      Tokpos = Tokbound;
+      free(name);
+      return;
+    }
+    fclose(f);
+  }
+  Pchname = name;
+}
+
+// If the parser has just reached the first token after the
+// headers, write out the precompiled header. Write it to a
+// temporary file first, so that other compiles never see
+// a partial file
+void savePch(void) {
+  char *tmpname;
+  int nextid;
+  FILE *f;
+
+  if (Pchname == NULL) return;
+  if (Tokpos != Toklen || Tokstdin || Peektoken.token != 0) return;
+
+  tmpname = (char *) malloc(strlen(Pchname) + 20);
+  if (tmpname == NULL)
+    fatal("Unable to malloc the precompiled header name");
+  sprintf(tmpname, "%s.%d", Pchname, getpid());
+  f = fopen(tmpname, "w");
+  if (f != NULL) {
+    putPchheader(f);
+    nextid = getnodeid();
+    fwrite(&nextid, sizeof(int), 1, f);
+    saveSymstate(f);
+    if (fclose(f) != 0 || rename(tmpname, Pchname) != 0)
+      unlink(tmpname);
+  }
+  free(tmpname);
+  free(Pchname);
+  Pchname = NULL;
+}
+#else
+#define tokgetc() fgetc(stdin)
+#define tokgetint(val) fread(val, sizeof(int), 1, stdin)
+#define tokgetstr(s, count) fgetstr(s, count, stdin)
+#endif
+
+#ifdef TOKINTERN
+// Read a varint from the token stream
+static int tokgetvar(void) {
+  int c, val = 0, shift = 0;
+
+  while ((c = tokgetc()) != EOF) {
+    val = val + ((c & 127) << shift);
+    if ((c & 128) == 0) break;
+    shift = shift + 7;
+  }
+  return (val);
+}
+#endif
+
 // Scan and return the next token found in the input.
 // Return 1 if token valid, 0 if no tokens left.
 int scan(struct token *t) {
@@ -54,10 +382,10 @@ int scan(struct token *t) {
     return (1);
   }
 
-  // We loop because we don't want to return
-  // T_FILENAME or T_LINENUM tokens
+  // We loop because we don't want to return T_FILENAME,
+  // T_LINENUM, T_LINEINC or T_LINEADV tokens
   while (1) {
-    t->token = fgetc(stdin);
+    t->token = tokgetc();
     if (t->token == EOF) {
       t->token = T_EOF;
       break;
@@ -65,22 +393,45 @@ int scan(struct token *t) {
 
     switch (t->token) {
     case T_LINENUM:
-      fread(&Line, sizeof(int), 1, stdin);
+      tokgetint(&Line);
       continue;
+#ifdef TOKLINEDELTA
+    case T_LINEINC:
+      Line++;
+      continue;
+    case T_LINEADV:
+      Line = Line + tokgetc();
+      continue;
+#endif
     case T_FILENAME:
       if (Infilename!=NULL) free(Infilename);
-      fgetstr(Text, TEXTLEN + 1, stdin);
+      tokgetstr(Text, TEXTLEN + 1);
       Infilename= strdup(Text);
       continue;
     case T_INTLIT:
     case T_CHARLIT:
-      fread(&intvalue, sizeof(int), 1, stdin);
+      tokgetint(&intvalue);
       t->intvalue = intvalue;
       break;
     case T_STRLIT:
     case T_IDENT:
-      fgetstr(Text, TEXTLEN + 1, stdin);
+      tokgetstr(Text, TEXTLEN + 1);
+      break;
+#ifdef TOKINTERN
+    case T_IDDEF:
+      intvalue = tokgetvar();
+      tokgetstr(Text, TEXTLEN + 1);
+      defineident(intvalue, Text);
+      t->token = T_IDENT;
       break;
+    case T_IDREF:
+      intvalue = tokgetvar();
+      if (intvalue >= Nidname)
+	fatald("Unknown identifier id in the token stream", intvalue);
+      strcpy(Text, Idname[intvalue]);
+      t->token = T_IDENT;
+      break;
+#endif
     }
 #ifdef DEBUG
     print_token(t);
@@ -136,23 +487,149 @@ void comma(void) {
   match(T_COMMA, "comma");
 }
 
+// The AST index file holds the offset in the AST file of each
+// AST node, indexed by node id. Slot zero holds the position in
+// the index file of the function table: the number of functions
+// followed by a struct ASTfunc for each one.
+//
+// The offsets for the function being serialised are buffered
+// in Idxbuf, which starts at node id Idxbase, and are written out
+// together once the function's A_FUNCTION node is serialised.
+#define IDXINCREMENT 256
+static long *Idxbuf= NULL;
+static int Idxbase= 1;
+static int Idxsize= 0;
+static int Idxhigh= 0;
+
+// The function table
+static struct ASTfunc *Funclist= NULL;
+static int Funccount= 0;
+
+// Record the AST file offset of the node with the given id
+static void saveASToffset(int id, long offset) {
+  int i, newsize;
+
+  // Ids below the buffer go straight to the file
+  if (id < Idxbase) {
+    fseek(Idxfile, id * sizeof(long), SEEK_SET);
+    fwrite(&offset, sizeof(long), 1, Idxfile);
+    return;
+  }
+
+  // Grow the buffer if needed, zeroing the new entries
+  if (id - Idxbase >= Idxsize) {
+    newsize= id - Idxbase + IDXINCREMENT;
+    Idxbuf= (long *)realloc(Idxbuf, newsize * sizeof(long));
+    if (Idxbuf==NULL)
+      fatal("Unable to malloc the AST index buffer");
+    for (i= Idxsize; i < newsize; i++)
+      Idxbuf[i]= 0;
+    Idxsize= newsize;
+  }
+
+  Idxbuf[id - Idxbase]= offset;
+  if (id > Idxhigh) Idxhigh= id;
+}
+
+// Write out the buffered AST offsets. Later
+// functions only use node ids above these.
+static void flushASTidx(void) {
+  int i, count;
+
+  if (Idxhigh < Idxbase) return;
+  count= Idxhigh - Idxbase + 1;
+  fseek(Idxfile, Idxbase * sizeof(long), SEEK_SET);
+  fwrite(Idxbuf, sizeof(long), count, Idxfile);
+  for (i= 0; i < count; i++)
+    Idxbuf[i]= 0;
+  Idxbase= Idxhigh + 1;
+}
+
+// Write out the function table and its position
+static void saveFunclist(void) {
+  long posn;
+
+  flushASTidx();
+  fseek(Idxfile, 0, SEEK_END);
+  posn= ftell(Idxfile);
+  if (posn < sizeof(long)) posn= sizeof(long);
+  fseek(Idxfile, posn, SEEK_SET);
+  fwrite(&Funccount, sizeof(int), 1, Idxfile);
+  if (Funccount != 0)
+    fwrite(Funclist, sizeof(struct ASTfunc), Funccount, Idxfile);
+  fseek(Idxfile, 0, SEEK_SET);
+  fwrite(&posn, sizeof(long), 1, Idxfile);
+}
+
 // Seralise an AST to Outfile
 void serialiseAST(struct ASTnode *tree) {
+  struct ASTfunc *func;
+  long offset;
+  int flags;
+
   if (tree==NULL) return;
 
+  // Record where this node is, and where each function starts
+  if (Idxfile != NULL) {
+    offset= ftell(Outfile);
+    saveASToffset(tree->nodeid, offset);
+    if (tree->op == A_FUNCTION) {
+      Funclist= (struct ASTfunc *)realloc(Funclist,
+				(Funccount+1) * sizeof(struct ASTfunc));
+      if (Funclist==NULL)
+	fatal("Unable to malloc the function list");
+      func= Funclist + Funccount;
+      func->offset= offset;
+      Funccount++;
+    }
+  }
+
+  // Work out which of the optional fields we need
+  flags= 0;
+  if (tree->leftid != 0) flags= flags + AF_LEFT;
+  if (tree->midid != 0) flags= flags + AF_MID;
+  if (tree->rightid != 0) flags= flags + AF_RIGHT;
+  if (tree->symid != 0) flags= flags + AF_SYMID;
+  if (tree->name != NULL) flags= flags + AF_NAME;
+  if (tree->a_intvalue != 0) flags= flags + AF_VALUE;
+  if (tree->linenum != 0) flags= flags + AF_LINE;
+
   // Dump this node
-  fwrite(tree, sizeof(struct ASTnode), 1, Outfile);
+  fputvar(tree->op * 2 + tree->rvalue, Outfile);
+  fputvar(flags, Outfile);
+  fputvar(tree->type, Outfile);
+  fputvar(tree->nodeid, Outfile);
+
+  // The children are usually close to this node, so
+  // store their ids as the difference from our id
+  if (tree->leftid != 0) fputsvar(tree->leftid - tree->nodeid, Outfile);
+  if (tree->midid != 0) fputsvar(tree->midid - tree->nodeid, Outfile);
+  if (tree->rightid != 0) fputsvar(tree->rightid - tree->nodeid, Outfile);
+  if (tree->symid != 0) fputvar(tree->symid, Outfile);
 
   // Dump any literal string/identifier
   if (tree->name!=NULL) {
+    fputvar(strlen(tree->name), Outfile);
     fputs(tree->name, Outfile);
     fputc(0, Outfile);
   }
+  if (tree->a_intvalue != 0) fputsvar(tree->a_intvalue, Outfile);
+  if (tree->linenum != 0) fputvar(tree->linenum, Outfile);
 
   // Dump all the children
   serialiseAST(tree->left);
   serialiseAST(tree->mid);
   serialiseAST(tree->right);
+
+  // The whole function is now in the AST file. Record
+  // where it ends and its range of node ids
+  if (Idxfile != NULL && tree->op == A_FUNCTION) {
+    func= Funclist + (Funccount - 1);
+    func->end= ftell(Outfile);
+    func->loid= Idxbase;
+    func->hiid= Idxhigh;
+    flushASTidx();
+  }
 }
 
 // Parse the token stream on stdin
@@ -160,13 +637,24 @@ void serialiseAST(struct ASTnode *tree) {
 // a symbol table.
 int main(int argc, char **argv) {
 
-  if (argc <2 || argc >3) {
-    fprintf(stderr, "Usage: %s symfile <astfile>\n", argv[0]);
+#ifdef PCHFILES
+  if (argc <2 || argc >6) {
+    fprintf(stderr, "Usage: %s symfile <astfile> <symidxfile> <idxfile> <pchdir>\n",
+								argv[0]);
+    fprintf(stderr, "  ASTs on stdout if astfile not specified\n");
+    fprintf(stderr, "  precompiled headers are kept in pchdir if given\n");
+    exit(1);
+  }
+#else
+  if (argc <2 || argc >5) {
+    fprintf(stderr, "Usage: %s symfile <astfile> <symidxfile> <idxfile>\n",
+								argv[0]);
     fprintf(stderr, "  ASTs on stdout if astfile not specified\n");
     exit(1);
   }
+#endif
 
-  if (argc==3) {
+  if (argc>=3) {
     Outfile= fopen(argv[2], "w");
     if (Outfile == NULL) {
       fprintf(stderr, "Can't create %s\n", argv[2]); exit(1);
@@ -174,17 +662,50 @@ int main(int argc, char **argv) {
   } else 
     Outfile= stdout;
 
+  // Write the AST file header
+  fputs("wat", Outfile);
+  fputc(ASTVERSION, Outfile);
+
   Symfile= fopen(argv[1], "w+");
   if (Symfile == NULL) {
     fprintf(stderr, "Can't create %s\n", argv[1]); exit(1);
   }
 
+  // Use a temporary symbol index file if we weren't given one
+  if (argc>=4)
+    Symidxfile= fopen(argv[3], "w+");
+  else
+    Symidxfile= tmpfile();
+  if (Symidxfile == NULL) {
+    fprintf(stderr, "Can't create the symbol index file\n"); exit(1);
+  }
+  startSymfile();		// Write the symbol file header
+
+  // Build the AST index file if we were given one
+  if (argc>=5) {
+    Idxfile= fopen(argv[4], "w");
+    if (Idxfile == NULL) {
+      fprintf(stderr, "Can't create %s\n", argv[4]); exit(1);
+    }
+  }
+
   freeSymtable();		// Clear the symbol table
+#ifdef PCHFILES
+  if (argc==6)
+    startPch(argv[5], argv[0]);	// Load or prepare a precompiled header
+#endif
   scan(&Token);                 // Get the first token from the input
   Peektoken.token = 0;		// and set there is no lookahead token
   global_declarations();        // Parse the global declarations
   flushSymtable();		// Flush any residual symbols
+  endSymfile();			// Write out the buffered symbol file
+  saveSymidx();			// and the symbol index hash buckets
+  fclose(Symidxfile);
   fclose(Symfile);
+  if (Idxfile != NULL) {
+    saveFunclist();		// Finish the AST index file
+    fclose(Idxfile);
+  }
   exit(0);
   return(0);
 }
@@ -9,3 +9,4 @@ void rparen(void);
 void ident(void);
 void comma(void);
 void serialiseAST(struct ASTnode *tree);
+void savePch(void);
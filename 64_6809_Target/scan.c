@@ -1,5 +1,12 @@
 #include "defs.h"
 #include "misc.h"
+#include "cpp.h"
+#include "keywords.h"
+#if defined(SCANBUFSIZE) && defined(MMAPFILES)
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 // Lexical scanning
 // Copyright (c) 2019 Warren Toomey, GPL3
@@ -11,10 +18,25 @@ int Putback = '\n';             // Character put back by scanner
 char *Infilename;               // Name of file we are parsing
 int Newfilename=0;		// Flag: has filename changed
 FILE *Infile;                   // Input file struct
+int Usecpp = 0;			// Read through the built-in cpp?
+int Preproc = 0;		// Only output the pre-processed text?
 struct token Token;             // Last token scanned
 struct token Peektoken;         // A look-ahead token
 char Text[TEXTLEN + 1];         // Last identifier scanned
 
+				// With -MF, we write the names of the
+				// files we read to a make dependency file
+char *Depname = NULL;		// Dependency file, or NULL
+char *Deptarget = NULL;		// Target which depends on the files
+int Depphony = 0;		// Add a phony target for each header?
+
+struct depfile {
+  char *name;
+  struct depfile *next;
+};
+struct depfile *Dephead = NULL;	// List of the files we read
+struct depfile *Deptail = NULL;
+
 int scan(struct token *t, int nocpp);
 
 // Return the position of character c
@@ -27,6 +49,161 @@ static int chrpos(char *s, int c) {
   return (-1);
 }
 
+// Add a file's name to the dependency list if it isn't
+// there already. Skip names like <built-in> from cpp
+static void adddep(char *name) {
+  struct depfile *this;
+
+  if (name[0] == '<' || name[0] == 0) return;
+  for (this = Dephead; this != NULL; this = this->next)
+    if (!strcmp(this->name, name)) return;
+
+  this = (struct depfile *) malloc(sizeof(struct depfile));
+  if (this == NULL)
+    fatal("Unable to malloc in adddep()");
+  this->name = strdup(name);
+  this->next = NULL;
+  if (Dephead == NULL) {
+    Dephead = Deptail = this;
+  } else {
+    Deptail->next = this; Deptail = this;
+  }
+}
+
+// Write a name to the dependency file,
+// with a backslash before any space
+static void putdepname(char *name, FILE *f) {
+  for (; *name; name++) {
+    if (*name == ' ') fputc('\\', f);
+    fputc(*name, f);
+  }
+}
+
+// Write the make dependency file: the target depends on
+// every file we read. With -MP, add an empty rule for each
+// header so that make doesn't fail if one is removed
+static void writedeps(void) {
+  struct depfile *this;
+  FILE *f;
+
+  if (Depname == NULL) return;
+  f = fopen(Depname, "w");
+  if (f == NULL) {
+    fprintf(stderr, "Unable to write %s\n", Depname);
+    exit(1);
+  }
+
+  putdepname(Deptarget, f);
+  fputc(':', f);
+  for (this = Dephead; this != NULL; this = this->next) {
+    fputs(" \\\n ", f);
+    putdepname(this->name, f);
+  }
+  fputc('\n', f);
+
+  if (Depphony && Dephead != NULL)
+    for (this = Dephead->next; this != NULL; this = this->next) {
+      fputc('\n', f);
+      putdepname(this->name, f);
+      fputs(":\n", f);
+    }
+  fclose(f);
+}
+
+// Change the filename and line number, as told
+// by a line marker or by the built-in cpp
+void setfileline(char *name, int line) {
+  if (strcmp(name, Infilename)) {	// If not the filename we have now
+    free(Infilename);
+    Infilename = strdup(name);	// save it. Then update the line num
+    Newfilename=1;
+    if (Depname != NULL)	// and note it as a dependency
+      adddep(name);
+  }
+  Line = line;
+  Newlinenum=1;
+
+  if (Preproc)			// Output a line marker
+    printf("# %d \"%s\"\n", line, name);
+}
+
+#ifdef SCANBUFSIZE
+// On hosts, the pre-processed input is read SCANBUFSIZE bytes at
+// a time into Inbuf, or is mapped into memory when it is a file
+// and we have mmap(). With the built-in cpp, Inbuf is instead the
+// span of characters which cpp says can come to us as they are
+// (see cppspan()). next() takes its characters straight from
+// Inptr, and only calls ingetc() at the end of the buffer. skip(),
+// scanident() and scanstr() find the end of a run of blanks, of
+// an identifier or of the plain characters in a string literal
+// in the buffer a word at a time (see misc.c)
+static char *Inbuf = NULL;	// The input buffer, mapping or span
+static char *Inptr = NULL;	// Next character in it
+static char *Inend = NULL;	// End of the characters in it
+static int Inmapped = 0;	// Is the whole input mapped?
+
+// Map the input file into memory if we can
+static void mapinput(void) {
+#ifdef MMAPFILES
+  struct stat sb;
+  char *base;
+  long posn;
+
+  if (fstat(fileno(Infile), &sb) == -1 || !S_ISREG(sb.st_mode))
+    return;
+  posn = lseek(fileno(Infile), 0, SEEK_CUR);
+  if (posn == -1 || posn >= sb.st_size)
+    return;
+  base = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fileno(Infile), 0);
+  if (base == MAP_FAILED)
+    return;
+  madvise(base, sb.st_size, MADV_SEQUENTIAL);
+  Inbuf = base;
+  Inptr = base + posn;
+  Inend = base + sb.st_size;
+  Inmapped = 1;
+#endif
+}
+
+// Get the next character once the buffer is empty:
+// read in the next block of input, or return EOF.
+// With the built-in cpp, tell it how much of its
+// span we used, then get the next character and
+// the span after that from it
+static int ingetc(void) {
+  int c, n;
+
+  if (Usecpp) {
+    cpptake(Inptr - Inbuf);
+    c = cppgetc();
+    n = cppspan(&Inbuf);
+    Inptr = Inbuf;
+    Inend = Inbuf + n;
+    return (c);
+  }
+
+  if (Inmapped)
+    return (EOF);
+  if (Inbuf == NULL) {
+    Inbuf = (char *) malloc(SCANBUFSIZE);
+    if (Inbuf == NULL)
+      fatal("Unable to malloc the input buffer");
+  }
+  n = fread(Inbuf, 1, SCANBUFSIZE, Infile);
+  if (n <= 0) {
+    Inptr = Inend = Inbuf;
+    return (EOF);
+  }
+  Inptr = Inbuf + 1;
+  Inend = Inbuf + n;
+  return (Inbuf[0] & 0xff);
+}
+
+#define infgetc() (Inptr < Inend ? (*Inptr++ & 0xff) : ingetc())
+#else
+#define infgetc() (Usecpp ? cppgetc() : fgetc(Infile))
+#endif
+
 // Get the next character from the input file.
 static int next(void) {
   int c, l;
@@ -37,9 +214,16 @@ static int next(void) {
     return (c);
   }
 
-  c = fgetc(Infile);		// Read from input file
+#ifdef SCANBUFSIZE
+  // In the middle of a line, any character but a
+  // newline can come straight from the buffer
+  if (Linestart == 0 && Inptr < Inend && *Inptr != '\n')
+    return (*Inptr++ & 0xff);
+#endif
+
+  c = infgetc();		// Read from the input or the built-in cpp
 
-  while (Linestart && c == '#') {	// We've hit a pre-processor statement
+  while (Usecpp == 0 && Linestart && c == '#') {	// We've hit a pre-processor statement
     Linestart = 0;		// No longer at the start of the line
     scan(&Token, 1);		// Get the line number into l
     if (Token.token != T_INTLIT)
@@ -50,18 +234,11 @@ static int next(void) {
     if (Token.token != T_STRLIT)
       fatals("Expecting pre-processor file name, got:", Text);
 
-    if (Text[0] != '<') {	// If this is a real filename
-      if (strcmp(Text, Infilename)) {	// and not the one we have now
-	free(Infilename);
-	Infilename = strdup(Text);	// save it. Then update the line num
-        Newfilename=1;
-      }
-      Line = l;
-      Newlinenum=1;
-    }
+    if (Text[0] != '<')		// If this is a real filename
+      setfileline(Text, l);
 
-    while ((c = fgetc(Infile)) != '\n');	// Skip to the end of the line
-    c = fgetc(Infile);		// and get the next character
+    while ((c = infgetc()) != '\n');	// Skip to the end of the line
+    c = infgetc();		// and get the next character
     Linestart = 1;		// Now back at the start of the line
   }
 
@@ -87,6 +264,11 @@ static int skip(void) {
 
   c = next();
   while (' ' == c || '\t' == c || '\n' == c || '\r' == c || '\f' == c) {
+#ifdef SCANBUFSIZE
+    // Skip any more blanks on this line in one go
+    if (Putback == 0 && Linestart == 0)
+      Inptr += blankspan(Inptr, Inend);
+#endif
     c = next();
   }
   return (c);
@@ -216,9 +398,25 @@ static int scanint(int c) {
 static int scanstr(char *buf) {
   int i, c;
   int slash;
+#ifdef SCANBUFSIZE
+  int n;
+#endif
 
   // Loop while we have enough buffer space
   for (i = 0; i < TEXTLEN - 1; i++) {
+#ifdef SCANBUFSIZE
+    // Copy the plain characters in the buffer in one go
+    if (Putback == 0 && Linestart == 0) {
+      n = stopspan(Inptr, Inend, '"', '\\', '\n');
+      if (n > TEXTLEN - 1 - i)
+	n = TEXTLEN - 1 - i;
+      memcpy(buf + i, Inptr, n);
+      Inptr += n;
+      i += n;
+      if (i == TEXTLEN - 1)
+	break;
+    }
+#endif
     // Get the next char and append to buf
     // Return when we hit the ending double quote
     // (which wasn't quoted with a backslash)
@@ -239,6 +437,9 @@ static int scanstr(char *buf) {
 // store it in buf[]. Return the identifier's length
 static int scanident(int c, char *buf, int lim) {
   int i = 0;
+#ifdef SCANBUFSIZE
+  int n;
+#endif
 
   // Allow digits, alpha and underscores
   while (isalpha(c) || isdigit(c) || '_' == c) {
@@ -249,6 +450,17 @@ static int scanident(int c, char *buf, int lim) {
     } else if (i < lim - 1) {
       buf[i++] = (char) c;
     }
+#ifdef SCANBUFSIZE
+    // Copy the rest of it in the buffer in one go
+    if (Putback == 0) {
+      n = identspan(Inptr, Inend);
+      if (i + n < lim - 1) {
+	memcpy(buf + i, Inptr, n);
+	Inptr += n;
+	i += n;
+      }
+    }
+#endif
     c = next();
   }
 
@@ -259,82 +471,18 @@ static int scanident(int c, char *buf, int lim) {
   return (i);
 }
 
-// Given a word from the input, return the matching
-// keyword token number or 0 if it's not a keyword.
-// Switch on the first letter so that we don't have
-// to waste time strcmp()ing against all the keywords.
-static int keyword(char *s) {
-  switch (*s) {
-    case 'b':
-      if (!strcmp(s, "break"))
-	return (T_BREAK);
-      break;
-    case 'c':
-      if (!strcmp(s, "case"))
-	return (T_CASE);
-      if (!strcmp(s, "char"))
-	return (T_CHAR);
-      if (!strcmp(s, "continue"))
-	return (T_CONTINUE);
-      break;
-    case 'd':
-      if (!strcmp(s, "default"))
-	return (T_DEFAULT);
-      break;
-    case 'e':
-      if (!strcmp(s, "else"))
-	return (T_ELSE);
-      if (!strcmp(s, "enum"))
-	return (T_ENUM);
-      if (!strcmp(s, "extern"))
-	return (T_EXTERN);
-      break;
-    case 'f':
-      if (!strcmp(s, "for"))
-	return (T_FOR);
-      break;
-    case 'i':
-      if (!strcmp(s, "if"))
-	return (T_IF);
-      if (!strcmp(s, "int"))
-	return (T_INT);
-      break;
-    case 'l':
-      if (!strcmp(s, "long"))
-	return (T_LONG);
-      break;
-    case 'r':
-      if (!strcmp(s, "return"))
-	return (T_RETURN);
-      break;
-    case 's':
-      if (!strcmp(s, "sizeof"))
-	return (T_SIZEOF);
-      if (!strcmp(s, "static"))
-	return (T_STATIC);
-      if (!strcmp(s, "struct"))
-	return (T_STRUCT);
-      if (!strcmp(s, "switch"))
-	return (T_SWITCH);
-      break;
-    case 't':
-      if (!strcmp(s, "typedef"))
-	return (T_TYPEDEF);
-      break;
-    case 'u':
-      if (!strcmp(s, "union"))
-	return (T_UNION);
-      break;
-    case 'v':
-      if (!strcmp(s, "void")) {
-	return (T_VOID);
-}
-      break;
-    case 'w':
-      if (!strcmp(s, "while"))
-	return (T_WHILE);
-      break;
-  }
+// Given a word from the input and its length, return the
+// matching keyword token number or 0 if it's not a keyword.
+// keywords.h is made by mkkeys: each keyword has its own slot
+// in the table, so we only need to strcmp() against one of them.
+static int keyword(char *s, int len) {
+  int h;
+
+  if (len < KEYMINLEN || len > KEYMAXLEN)
+    return (0);
+  h = keyhash(s, len);
+  if (!strcmp(s, Keyname[h]))
+    return (Keytoken[h]);
   return (0);
 }
 
@@ -352,7 +500,8 @@ char *Tstring[] = {
   "case", "default", "sizeof", "static",
   "intlit", "strlit", ";", "identifier",
   "{", "}", "(", ")", "[", "]", ",", ".",
-  "->", ":", "...", "charlit", "filename", "linenum"
+  "->", ":", "...", "charlit", "filename", "linenum",
+  "iddef", "idref", "lineinc", "lineadv"
 };
 #endif
 
@@ -362,7 +511,7 @@ char *Tstring[] = {
 // This is because we use scan() when parsing new filenames
 // and line numbers :-)
 int scan(struct token *t, int nocpp) {
-  int c, tokentype;
+  int c, len, tokentype;
   int slash;
 
   // Skip whitespace
@@ -571,10 +720,10 @@ int scan(struct token *t, int nocpp) {
 	break;
       } else if (isalpha(c) || '_' == c) {
 	// Read in a keyword or identifier
-	scanident(c, Text, TEXTLEN);
+	len = scanident(c, Text, TEXTLEN);
 
 	// If it's a recognised keyword, return that token
-	if ((tokentype = keyword(Text)) != 0) {
+	if ((tokentype = keyword(Text, len)) != 0) {
 	  t->token = tokentype;
 	  break;
 	}
@@ -590,13 +739,133 @@ int scan(struct token *t, int nocpp) {
   return (1);
 }
 
-// Read lines of code from stdin and output
-// a token stream
-int main() {
-  int i;
+#ifdef TOKINTERN
+// On hosts, identifiers are interned in the token stream. The
+// first time we see a name, we send T_IDDEF, a varint id and the
+// NUL-terminated name. After that, we send T_IDREF and the id.
+// The ids count up from zero in the order the names are seen.
+#define NIDHASH 4096		// Buckets in the identifier hash table
+
+struct ident {
+  char *name;
+  int id;
+  struct ident *next;
+};
+static struct ident *Idhash[NIDHASH];
+static int Nidents = 0;		// Number of names with an id
+
+// Send an identifier to the token stream
+static void putident(char *name) {
+  struct ident *this;
+  unsigned int h = 0;
+  char *s;
+
+  for (s = name; *s; s++)
+    h = h * 31 + *s;
+  h = h % NIDHASH;
+  for (this = Idhash[h]; this != NULL; this = this->next)
+    if (!strcmp(this->name, name)) {
+      fputc(T_IDREF, stdout);
+      fputvar(this->id, stdout);
+      return;
+    }
+
+  this = (struct ident *) malloc(sizeof(struct ident));
+  if (this == NULL)
+    fatal("Unable to malloc in putident()");
+  this->name = strdup(name);
+  this->id = Nidents++;
+  this->next = Idhash[h];
+  Idhash[h] = this;
+  fputc(T_IDDEF, stdout);
+  fputvar(this->id, stdout);
+  fputs(name, stdout);
+  fputc(0, stdout);
+}
+#endif
+
+#ifdef TOKLINEDELTA
+// On hosts, a line number one more than the last one we sent goes
+// out as T_LINEINC, and one from 2 to 255 more as T_LINEADV and a
+// byte with the difference. Any other line number is a T_LINENUM
+static int Sentline = -1;	// Last line number sent, or -1
+
+// Send a line number to the token stream
+static void putline(int line) {
+  int delta = line - Sentline;
+
+  if (Sentline == -1 || delta < 1 || delta > 255) {
+    fputc(T_LINENUM, stdout);
+    fwrite(&line, sizeof(int), 1, stdout);
+  } else if (delta == 1) {
+    fputc(T_LINEINC, stdout);
+  } else {
+    fputc(T_LINEADV, stdout);
+    fputc(delta, stdout);
+  }
+  Sentline = line;
+}
+#endif
+
+// Read lines of code from stdin and output a token stream.
+// Or, read them from the C file named in the arguments,
+// through the built-in cpp with any -I directories and
+// -D definitions. With -E, only output the pre-processed text.
+// With -MF, also write a make dependency file for the -MT target
+int main(int argc, char **argv) {
+  int i, c;
 
   Infile= stdin;
   Infilename = strdup("");	// Cpp hasn't told us the filename yet
+  for (i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-E")) {
+      Preproc = 1;
+    } else if (!strcmp(argv[i], "-I") && i < argc - 1) {
+      i++; cppinclude(argv[i]);
+    } else if (!strcmp(argv[i], "-D") && i < argc - 1) {
+      i++; cppdefine(argv[i]);
+    } else if (!strcmp(argv[i], "-MF") && i < argc - 1) {
+      i++; Depname = argv[i];
+    } else if (!strcmp(argv[i], "-MT") && i < argc - 1) {
+      i++; Deptarget = argv[i];
+    } else if (!strcmp(argv[i], "-MP")) {
+      Depphony = 1;
+    } else if (argv[i][0] == '-' || Usecpp) {
+      fprintf(stderr,
+	"Usage: %s [-E] [-I dir] [-D name=value] [-MF depfile] [-MT target] [-MP] [file]\n",
+								argv[0]);
+      exit(1);
+    } else {
+      Usecpp = 1;
+      cppopen(argv[i]);
+    }
+  }
+
+  if (Depname != NULL && Deptarget == NULL) {
+    fprintf(stderr, "%s: -MF needs a -MT target\n", argv[0]);
+    exit(1);
+  }
+
+  // Output the pre-processed text
+  if (Preproc) {
+    if (Usecpp == 0) {
+      fprintf(stderr, "%s: -E needs a C file\n", argv[0]);
+      exit(1);
+    }
+    while ((c = cppgetc()) != EOF) {
+      if (c == '\n')
+	Line++;
+      fputc(c, stdout);
+    }
+    writedeps();
+    exit(0);
+  }
+
+#ifdef SCANBUFSIZE
+  if (Usecpp == 0)		// Map stdin if it is a file
+    mapinput();
+#endif
+
   Peektoken.token = 0;          // Set there is no lookahead token
   scan(&Token, 0);              // Get the first token from the input
 
@@ -606,6 +875,20 @@ int main() {
     // Output a binary stream of tokens to standard output.
     // T_INTLIT tokens are followed by the n-byte literal value.
     // T_STRLIT and T_IDENT tokens are followed by a NUL-terminated string.
+#ifdef TOKINTERN
+    if (Token.token == T_IDENT) {
+      putident(Text);
+      scan(&Token, 0);
+      continue;
+    }
+#endif
+#ifdef TOKLINEDELTA
+    if (Token.token == T_LINENUM) {
+      putline(Line);
+      scan(&Token, 0);
+      continue;
+    }
+#endif
     fputc(Token.token, stdout);
     switch (Token.token) {
     case T_INTLIT:
@@ -638,7 +921,8 @@ int main() {
     }
     scan(&Token, 0);
   }
-  
+
+  writedeps();
   exit(0);
   return(0);
 }
@@ -31,6 +31,17 @@ static struct symtable *Typetail = NULL;
 static struct symtable *Membhead = NULL;
 static struct symtable *Membtail = NULL;
 
+// The types and symbols lists are a cache of the symbol file.
+// At the end of each function, trimSymtable() evicts the least
+// recently used symbols until the lists fit within SYMCACHESIZE
+// bytes. Each symbol records the epoch when it was last used,
+// and the epoch goes up by one at each trim.
+#ifndef SYMCACHESIZE
+#define SYMCACHESIZE 2048
+#endif
+
+static int Symepoch = 1;
+
 #ifdef DEBUG
 static void dumptable(struct symtable *head, int indent);
 
@@ -147,8 +158,207 @@ static void appendSym(struct symtable **head, struct symtable **tail,
   node->next = NULL;
 }
 
-// The last name we loaded from the symbol file
+// The last name we loaded from the symbol file. Symname
+// points either at SymText or, if the symbol file is
+// memory mapped, at the name in the mapping.
 static char SymText[TEXTLEN + 1];
+static char *Symname;
+
+#ifdef WRITESYMS
+// The parser appends the records of each section of the symbol
+// file to Sectbuf[], which holds the end of the section from
+// offset Secttailoff[]. The earlier records are in Sectfile[],
+// starting at Sectbase[]. The functions section goes straight to
+// Symfile after the directory. The others go to temporary files
+// which endSymfile() copies to the end of Symfile. The buffers
+// are only written out when they fill up, so the files aren't
+// flushed and repositioned for each symbol.
+//
+// loadSym() reads from offset Symreadoff in section Readsect.
+// Sectfilepos[] is where we left each file, or -1 if we don't know.
+#ifndef SYMBUFSIZE
+#define SYMBUFSIZE 256
+#endif
+static FILE *Sectfile[NSYMSECT];
+static char *Sectbuf[NSYMSECT];
+static long Sectbase[NSYMSECT];
+static long Secttailoff[NSYMSECT];
+static int Secttaillen[NSYMSECT];
+static long Sectfilepos[NSYMSECT];
+static int Cursect = SS_FUNCS;
+static int Readsect = SS_FUNCS;
+static long Symreadoff = 0;
+
+// Position the reads of the symbol file at
+// an offset from the symbol index file
+static void symseek(long offset) {
+  Readsect = (int) (offset % NSYMSECT);
+  Symreadoff = offset / NSYMSECT;
+}
+
+// Read the next byte of the symbol file. Return -1 at
+// the end of the section
+static int symgetc(void) {
+  char *buf;
+  FILE *f;
+  int c;
+
+  if (Symreadoff >= Secttailoff[Readsect]) {
+    if (Symreadoff - Secttailoff[Readsect] >= Secttaillen[Readsect])
+      return (-1);
+    buf = Sectbuf[Readsect];
+    c = buf[Symreadoff - Secttailoff[Readsect]] & 0xff;
+    Symreadoff++;
+    return (c);
+  }
+
+  f = Sectfile[Readsect];
+  if (Sectfilepos[Readsect] != Symreadoff)
+    fseek(f, Sectbase[Readsect] + Symreadoff, SEEK_SET);
+  c = fgetc(f);
+  if (c == EOF) {
+    Sectfilepos[Readsect] = -1; return (-1);
+  }
+  Symreadoff++;
+  Sectfilepos[Readsect] = Symreadoff;
+  return (c);
+}
+
+// Read a varint from the symbol file. Return -1 at the end
+static int symgetvar(void) {
+  uvar val = 0;
+  uvar part;
+  int shift = 0;
+  int c;
+
+  while (1) {
+    c = symgetc();
+    if (c == -1) return (-1);
+    part = c & 127;
+    val = val + (part << shift);
+    if ((c & 128) == 0) break;
+    shift = shift + 7;
+  }
+  return (val);
+}
+
+// Read a zigzag-encoded varint from the symbol file
+static int symgetsvar(void) {
+  return (unzigzag(symgetvar()));
+}
+
+// Read a NUL-terminated string from the symbol file
+// into SymText. Return NULL at the end of the file
+static char *symgetstr(void) {
+  int c, i;
+
+  i = 0;
+  while (1) {
+    c = symgetc();
+    if (c == -1) return (NULL);
+    if (i < TEXTLEN) SymText[i] = (char) c;
+    if (c == 0) break;
+    i++;
+  }
+  SymText[TEXTLEN] = 0;
+  return (SymText);
+}
+
+// Skip over count bytes in the symbol file
+static void symskip(int count) {
+  Symreadoff = Symreadoff + count;
+}
+#else
+// The code generator reads the symbol file directly.
+// Symsectoff[] holds the offset of each section
+static long Symsectoff[NSYMSECT + 1];
+
+// Position the reads of the symbol file at
+// an offset from the symbol index file
+static void symseek(long offset) {
+  int sect;
+
+  sect = (int) (offset % NSYMSECT);
+  mseek(Symfile, Symsectoff[sect] + offset / NSYMSECT, SEEK_SET);
+}
+
+#define symgetvar()	fgetvar(Symfile)
+#define symgetsvar()	fgetsvar(Symfile)
+#define symgetstr()	mgetstr(SymText, TEXTLEN + 1, Symfile)
+#define symskip(count)	mseek(Symfile, count, SEEK_CUR)
+#endif
+
+// The symbol index file lets us go straight to a symbol in
+// the symbol file instead of scanning it from the start.
+// It begins with NSYMHASH bucket heads: each is the id of
+// the first non-local symbol whose name hashes to that bucket.
+// After this there is an entry for each symbol id: the symbol's
+// offset in the symbol file, and the id of the next symbol in
+// the same hash bucket (or zero).
+#define NSYMHASH 64
+
+static int Symhash[NSYMHASH];
+
+#ifdef WRITESYMS
+// The parser keeps the index entries for the symbols with ids
+// from Symidxbase up to Symidxhigh in Symidxoffs and Symidxnext,
+// and writes them out together in flushSymidx(). Entries for
+// lower ids are written straight to the symbol index file.
+#define SYMIDXINCREMENT 64
+static long *Symidxoffs = NULL;
+static int *Symidxnext = NULL;
+static int Symidxbase = 1;
+static int Symidxsize = 0;
+static int Symidxhigh = 0;
+#endif
+
+// Return the offset of a symbol id's entry in the symbol index file
+static long symidxoff(int id) {
+  long off;
+
+  off = sizeof(long) + sizeof(int);
+  off = off * id;
+  return (off + NSYMHASH * sizeof(int));
+}
+
+// Return the hash bucket for a symbol name. We keep
+// the running value within 15 bits so that the host
+// and the 6809 versions of the compiler agree.
+static int symhash(char *name) {
+  int h = 0;
+
+  while (*name != 0) {
+    h = (h * 31 + *name) & 0x7fff;
+    name++;
+  }
+  return (h & (NSYMHASH - 1));
+}
+
+// Given a symbol id, get its offset in the symbol file and
+// the id of the next symbol in the same hash bucket.
+// Return 1 if found, 0 if there is no entry for this id.
+static int getSymidx(int id, long *offset, int *nextid) {
+#ifdef WRITESYMS
+  // The entries above Symidxbase are still in memory
+  if (id >= Symidxbase) {
+    if (id > Symidxhigh) return (0);
+    *offset = Symidxoffs[id - Symidxbase];
+    *nextid = Symidxnext[id - Symidxbase];
+    if (*offset == -1) return (0);
+    return (1);
+  }
+#endif
+  mseek(Symidxfile, symidxoff(id), SEEK_SET);
+  if (mread(offset, sizeof(long), 1, Symidxfile) != 1) return (0);
+  if (mread(nextid, sizeof(int), 1, Symidxfile) != 1) return (0);
+  return (1);
+}
+
+// Read the hash bucket heads in from the symbol index file
+void loadSymidx(void) {
+  mseek(Symidxfile, 0, SEEK_SET);
+  mread(Symhash, sizeof(int), NSYMHASH, Symidxfile);
+}
 
 #ifdef WRITESYMS
 // Unique id for each symbol. We need this when serialising
@@ -171,13 +381,212 @@ struct symtable *thisSym = NULL;
 static int highestSymid = 0;
 static int skipSymid = 0;
 
+// The id of the last symbol in each hash bucket
+static int Symhashtail[NSYMHASH];
+
+// Add the symbol's offset in the symbol file to the
+// symbol index. Append any non-local symbol to the
+// hash bucket for its name.
+static void addSymidx(struct symtable *sym, long offset) {
+  int h, id, i;
+
+  id = sym->id;
+  if (id >= Symidxbase) {
+    // Make room for the entry in memory
+    if (id - Symidxbase >= Symidxsize) {
+      i = Symidxsize;
+      Symidxsize = id - Symidxbase + SYMIDXINCREMENT;
+      Symidxoffs = (long *) realloc(Symidxoffs, Symidxsize * sizeof(long));
+      Symidxnext = (int *) realloc(Symidxnext, Symidxsize * sizeof(int));
+      if (Symidxoffs == NULL || Symidxnext == NULL)
+	fatal("Unable to malloc the symbol index entries");
+      while (i < Symidxsize) {
+	Symidxoffs[i] = -1; Symidxnext[i] = 0; i++;
+      }
+    }
+    Symidxoffs[id - Symidxbase] = offset;
+    Symidxnext[id - Symidxbase] = 0;
+    if (id > Symidxhigh) Symidxhigh = id;
+  } else if (id <= skipSymid) {
+    // A changed symbol being written out again. It
+    // is already in its hash bucket, so only move it
+    fseek(Symidxfile, symidxoff(id), SEEK_SET);
+    fwrite(&offset, sizeof(long), 1, Symidxfile);
+    return;
+  } else {
+    i = 0;
+    fseek(Symidxfile, symidxoff(id), SEEK_SET);
+    fwrite(&offset, sizeof(long), 1, Symidxfile);
+    fwrite(&i, sizeof(int), 1, Symidxfile);
+  }
+
+  // Locals, parameters and members are
+  // only ever loaded along with their parent
+  if (sym->name == NULL || sym->class >= V_LOCAL) return;
+
+  // Link the previous tail of the bucket to this symbol
+  h = symhash(sym->name);
+  if (Symhashtail[h] == 0) {
+    Symhash[h] = id;
+  } else if (Symhashtail[h] >= Symidxbase) {
+    Symidxnext[Symhashtail[h] - Symidxbase] = id;
+  } else {
+    fseek(Symidxfile, symidxoff(Symhashtail[h]) + sizeof(long), SEEK_SET);
+    fwrite(&id, sizeof(int), 1, Symidxfile);
+  }
+  Symhashtail[h] = id;
+}
+
+// Write the in-memory symbol index entries out
+static void flushSymidx(void) {
+  int i;
+
+  if (Symidxhigh < Symidxbase) return;
+  fseek(Symidxfile, symidxoff(Symidxbase), SEEK_SET);
+  for (i = 0; i <= Symidxhigh - Symidxbase; i++) {
+    fwrite(Symidxoffs + i, sizeof(long), 1, Symidxfile);
+    fwrite(Symidxnext + i, sizeof(int), 1, Symidxfile);
+    Symidxoffs[i] = -1; Symidxnext[i] = 0;
+  }
+  Symidxbase = Symidxhigh + 1;
+}
+
+// Write the hash bucket heads out to the symbol index file
+void saveSymidx(void) {
+  fseek(Symidxfile, 0, SEEK_SET);
+  fwrite(Symhash, sizeof(int), NSYMHASH, Symidxfile);
+}
+
+// Write the buffered end of a symbol file section out
+static void writeSymtail(int sect) {
+  FILE *f;
+
+  if (Secttaillen[sect] == 0) return;
+  f = Sectfile[sect];
+  fseek(f, Sectbase[sect] + Secttailoff[sect], SEEK_SET);
+  fwrite(Sectbuf[sect], 1, Secttaillen[sect], f);
+  Secttailoff[sect] = Secttailoff[sect] + Secttaillen[sect];
+  Secttaillen[sect] = 0;
+  Sectfilepos[sect] = -1;
+}
+
+// Append a byte to the current symbol file section
+static void symputc(int c) {
+  char *buf;
+
+  if (Secttaillen[Cursect] == SYMBUFSIZE) writeSymtail(Cursect);
+  buf = Sectbuf[Cursect];
+  buf[Secttaillen[Cursect]] = (char) c;
+  Secttaillen[Cursect] = Secttaillen[Cursect] + 1;
+}
+
+// Append a value to the symbol file as a varint.
+// The value's bits are taken as unsigned
+static void symputvar(int val) {
+  uvar v = val;
+
+  while ((v & ~127) != 0) {
+    symputc((v & 127) + 128);
+    v = v >> 7;
+  }
+  symputc(v);
+}
+
+// Append a value which may be negative to the
+// symbol file as a zigzag-encoded varint
+static void symputsvar(int val) {
+  symputvar(zigzag(val));
+}
+
+// Write the header at the start of the symbol table file,
+// leaving room for the directory. Set up the sections
+void startSymfile(void) {
+  int i;
+
+  fputs("wsy", Symfile);
+  fputc(SYMVERSION, Symfile);
+  for (i = 0; i < SYMDIRLEN; i++)
+    fputc(0, Symfile);
+
+  for (i = 0; i < NSYMSECT; i++) {
+    Sectbuf[i] = (char *) malloc(SYMBUFSIZE);
+    if (Sectbuf[i] == NULL)
+      fatal("Unable to malloc the symbol file buffers");
+    if (i == SS_FUNCS) {
+      Sectfile[i] = Symfile;
+      Sectbase[i] = SYMHDRLEN + SYMDIRLEN;
+    } else {
+      Sectfile[i] = tmpfile();
+      Sectbase[i] = 0;
+      if (Sectfile[i] == NULL)
+	fatal("Unable to create a temporary symbol file");
+    }
+    Secttailoff[i] = 0;
+    Secttaillen[i] = 0;
+    Sectfilepos[i] = -1;
+  }
+}
+
+// Write out the rest of the symbol file and its index.
+// Append the other sections to the functions section
+// and fill in the directory
+void endSymfile(void) {
+  FILE *f;
+  char *buf;
+  long len;
+  int sect, i, n;
+
+  writeSymtail(SS_FUNCS);
+  buf = Sectbuf[SS_FUNCS];
+  fseek(Symfile, Sectbase[SS_FUNCS] + Secttailoff[SS_FUNCS], SEEK_SET);
+  for (sect = SS_FUNCS + 1; sect < NSYMSECT; sect++) {
+    f = Sectfile[sect];
+    fseek(f, 0, SEEK_SET);
+    len = Secttailoff[sect];
+    while (len > 0) {
+      n = SYMBUFSIZE;
+      if (len < n) n = (int) len;
+      if (fread(buf, 1, n, f) != n)
+	fatal("Unable to read a temporary symbol file");
+      fwrite(buf, 1, n, Symfile);
+      len = len - n;
+    }
+    fwrite(Sectbuf[sect], 1, Secttaillen[sect], Symfile);
+    fclose(f);
+  }
+
+  fseek(Symfile, SYMHDRLEN, SEEK_SET);
+  for (sect = 0; sect < NSYMSECT; sect++) {
+    len = Secttailoff[sect] + Secttaillen[sect];
+    for (i = 0; i < 4; i++) {
+      fputc((int) (len & 0xff), Symfile);
+      len = len >> 8;
+    }
+  }
+  flushSymidx();
+}
+
+// Return the symbol file section for a symbol
+static int symsection(struct symtable *sym) {
+  if (sym->stype >= S_STRUCT) return (SS_TYPES);
+  if (sym->class == V_GLOBAL || sym->class == V_STATIC) {
+    if (sym->stype == S_VARIABLE || sym->stype == S_ARRAY)
+      return (SS_GLOBALS);
+    if (sym->stype == S_STRLIT)
+      return (SS_STRLITS);
+  }
+  return (SS_FUNCS);
+}
+
 // Serialise one symbol to the symbol table file
 static void serialiseSym(struct symtable *sym) {
   struct symtable *memb;
+  int flags, nmembs, i, rewrite;
+  long offset;
 
   if (sym->id > highestSymid) highestSymid = sym->id;
 
-  if (sym->id <= skipSymid) {
+  if (sym->id <= skipSymid && sym->st_changed == 0) {
 #ifdef DEBUG
     fprintf(stderr, "NOT Writing %s %s id %d to disk\n",
 	    Sstring[sym->stype], sym->name, sym->id);
@@ -185,20 +594,59 @@ static void serialiseSym(struct symtable *sym) {
     return;
   }
 
-  // Output the symbol struct and the name
-  // once we are at the end of the file
-  fseek(Symfile, 0, SEEK_END);
+  // Append the symbol struct and the name to the current
+  // section. Its index entry also holds the section number
+  offset = Secttailoff[Cursect] + Secttaillen[Cursect];
+  offset = offset * NSYMSECT + Cursect;
 #ifdef DEBUG
   fprintf(stderr, "Writing %s %s id %d to disk offset %ld\n",
-	  Sstring[sym->stype], sym->name, sym->id, ftell(Symfile));
+	  Sstring[sym->stype], sym->name, sym->id, offset);
 #endif
-  fwrite(sym, sizeof(struct symtable), 1, Symfile);
+  addSymidx(sym, offset);
+
+  // The new record of a changed symbol replaces its old one,
+  // e.g. one from a precompiled header. loadSym() reads the
+  // members which follow the record, so write all of them
+  rewrite = sym->st_changed;
+  sym->st_changed = 0;
+
+  // Count the members which will be written out
+  nmembs = 0;
+  for (memb = sym->member; memb != NULL; memb = memb->next)
+    if (rewrite || memb->id > skipSymid) nmembs++;
+
+  flags = 0;
+  if (sym->name != NULL) flags = flags + SF_NAME;
+  if (sym->initlist != NULL) flags = flags + SF_INIT;
+  if (sym->st_hasaddr != 0) flags = flags + SF_HASADDR;
+  if (nmembs != 0) flags = flags + SF_MEMBS;
+
+  // Output the fixed fields of the record
+  symputvar(sym->type);
+  symputvar(sym->class * 16 + sym->stype);
+  symputvar(flags);
+  symputvar(sym->id);
+  symputvar(sym->ctypeid);
+  symputsvar(sym->size);
+  symputsvar(sym->nelems);
+  symputsvar(sym->st_posn);
+
+  // Output the name with its length
   if (sym->name != NULL) {
-    fputs(sym->name, Symfile); fputc(0, Symfile);
+    symputvar(strlen(sym->name));
+    for (i = 0; sym->name[i] != 0; i++)
+      symputc(sym->name[i]);
+    symputc(0);
   }
+
   // Output the initial values, if any
   if (sym->initlist != NULL)
-    fwrite(sym->initlist, sizeof(int), sym->nelems, Symfile);
+    for (i = 0; i < sym->nelems; i++)
+      symputsvar(sym->initlist[i]);
+
+  // and the number of member records which follow
+  if (nmembs != 0)
+    symputvar(nmembs);
 
   // Output the member symbols
 #ifdef DEBUG
@@ -207,8 +655,10 @@ static void serialiseSym(struct symtable *sym) {
   }
 #endif
 
-  for (memb = sym->member; memb != NULL; memb = memb->next)
+  for (memb = sym->member; memb != NULL; memb = memb->next) {
+    if (rewrite) memb->st_changed = 1;
     serialiseSym(memb);
+  }
 }
 
 // Create a symbol table node. Set up the node's:
@@ -241,10 +691,13 @@ static struct symtable *newsym(char *name, int type, struct symtable *ctype,
   node->class = class;
   node->nelems = nelems;
   node->st_hasaddr = 0;
+  node->st_lastuse = Symepoch;
+  node->st_changed = 0;
 
   // For pointers and integer types, set the size
   // of the symbol. structs and union declarations
   // manually set this up themselves.
+  node->size = 0;
   if (ptrtype(type) || inttype(type))
     node->size = nelems * typesize(type, ctype);
 
@@ -318,25 +771,145 @@ void flushSymtable() {
 
   // Write out types
   for (this = Typehead; this != NULL; this = this->next) {
+    Cursect = symsection(this);
     serialiseSym(this);
   }
 
   // Write out variables and functions.
   // Skip invalid symbols
   for (this = Symhead; this != NULL; this = this->next) {
+    Cursect = symsection(this);
     serialiseSym(this);
   }
 
   skipSymid = highestSymid;
+  flushSymidx();
+  trimSymtable();
+}
+
+#ifdef PCHFILES
+// A precompiled header file holds the state of the symbol file
+// once the headers at the start of a C file have been parsed:
+// the symbol id counters, the hash buckets, the symbol index
+// entries so far and the contents of each section. All the
+// in-memory symbols are written out and freed first, so later
+// lookups find them through the index as usual.
+
+// Copy len bytes from offset posn in the from file to the
+// current position in the to file. Return 1 if successful
+static int copySymbytes(FILE *from, long posn, long len, FILE *to) {
+  char buf[4096];
+  int n;
+
+  fseek(from, posn, SEEK_SET);
+  while (len > 0) {
+    n = sizeof(buf);
+    if (len < n) n = (int) len;
+    if (fread(buf, 1, n, from) != n) return (0);
+    if (fwrite(buf, 1, n, to) != n) return (0);
+    len = len - n;
+  }
+  return (1);
+}
+
+// Write out the symbol state to a precompiled header file
+void saveSymstate(FILE *f) {
+  long len;
+  int sect;
+
+  flushSymtable();
+  fwrite(&Symid, sizeof(int), 1, f);
+  fwrite(&highestSymid, sizeof(int), 1, f);
+  fwrite(&skipSymid, sizeof(int), 1, f);
+  fwrite(Symhash, sizeof(int), NSYMHASH, f);
+  fwrite(Symhashtail, sizeof(int), NSYMHASH, f);
+
+  // The index entries, which flushSymtable() wrote out
+  len = symidxoff(Symidxbase) - symidxoff(1);
+  fwrite(&len, sizeof(long), 1, f);
+  fflush(Symidxfile);
+  if (copySymbytes(Symidxfile, symidxoff(1), len, f) == 0)
+    fatal("Unable to read the symbol index file");
+
+  // The contents of each section
+  for (sect = 0; sect < NSYMSECT; sect++) {
+    len = Secttailoff[sect] + Secttaillen[sect];
+    fwrite(&len, sizeof(long), 1, f);
+    fflush(Sectfile[sect]);
+    if (copySymbytes(Sectfile[sect], Sectbase[sect],
+		     Secttailoff[sect], f) == 0)
+      fatal("Unable to read the symbol file");
+    Sectfilepos[sect] = -1;
+    fwrite(Sectbuf[sect], 1, Secttaillen[sect], f);
+  }
+
   freeSymtable();
+  thisSym = NULL;
 }
-#endif // WRITESYMS
 
-// When reading in globals that have members (structs, unions,
-// functions), we stop once we hit a non-member. We need to
-// record that symbol's offset so we can fseek() back to that.
-// Otherwise we would not be able to load it if it also was a global.
-static long lastSymOffset;
+// Load the symbol state in from a precompiled header file
+void loadSymstate(FILE *f) {
+  long len;
+  int sect, ok;
+
+  ok = fread(&Symid, sizeof(int), 1, f) == 1;
+  ok = ok && fread(&highestSymid, sizeof(int), 1, f) == 1;
+  ok = ok && fread(&skipSymid, sizeof(int), 1, f) == 1;
+  ok = ok && fread(Symhash, sizeof(int), NSYMHASH, f) == NSYMHASH;
+  ok = ok && fread(Symhashtail, sizeof(int), NSYMHASH, f) == NSYMHASH;
+
+  // Put the index entries back and start
+  // buffering them after the last one
+  ok = ok && fread(&len, sizeof(long), 1, f) == 1;
+  fseek(Symidxfile, symidxoff(1), SEEK_SET);
+  ok = ok && copySymbytes(f, ftell(f), len, Symidxfile);
+  Symidxhigh = (int) (len / (sizeof(long) + sizeof(int)));
+  Symidxbase = Symidxhigh + 1;
+
+  // Put each section's contents back in its file
+  for (sect = 0; sect < NSYMSECT; sect++) {
+    ok = ok && fread(&len, sizeof(long), 1, f) == 1;
+    fseek(Sectfile[sect], Sectbase[sect], SEEK_SET);
+    ok = ok && copySymbytes(f, ftell(f), len, Sectfile[sect]);
+    Secttailoff[sect] = len;
+    Secttaillen[sect] = 0;
+    Sectfilepos[sect] = -1;
+  }
+
+  if (ok == 0)
+    fatal("Unable to load the precompiled header file");
+  thisSym = NULL;
+}
+#endif // PCHFILES
+#else
+
+// Check the header at the start of the symbol table file and
+// read in the directory to find where each section starts.
+// Return 1 if we can read this file's records, 0 otherwise.
+int checkSymfile(void) {
+  char hdr[SYMHDRLEN];
+  char dir[SYMDIRLEN];
+  long posn, len;
+  int sect, i;
+
+  mseek(Symfile, 0, SEEK_SET);
+  if (mread(hdr, 1, SYMHDRLEN, Symfile) != SYMHDRLEN) return (0);
+  if (hdr[0] != 'w' || hdr[1] != 's' || hdr[2] != 'y') return (0);
+  if (hdr[3] != SYMVERSION) return (0);
+  if (mread(dir, 1, SYMDIRLEN, Symfile) != SYMDIRLEN) return (0);
+
+  posn = SYMHDRLEN + SYMDIRLEN;
+  for (sect = 0; sect < NSYMSECT; sect++) {
+    Symsectoff[sect] = posn;
+    len = 0;
+    for (i = 3; i >= 0; i--)
+      len = len * 256 + (dir[sect * 4 + i] & 0xff);
+    posn = posn + len;
+  }
+  Symsectoff[NSYMSECT] = posn;
+  return (1);
+}
+#endif // WRITESYMS
 
 // We need a linked list when loadSym() loads in members of a symbol
 // from the disk. We can't use Membhead/tail as this might be in use
@@ -352,6 +925,7 @@ static struct symtable *Mhead, *Mtail;
 static int loadSym(struct symtable *sym, char *name,
 		   int stype, int id, int loadit, int recurse) {
   struct symtable *memb;
+  int flags, len, nmembs, i;
 
 #ifdef DEBUGTOOMUCH
 if (name!=NULL)
@@ -362,131 +936,148 @@ else
 		id, stype, loadit, recurse);
 #endif
 
-  // Read in the next node. Get a copy of the offset beforehand
-  lastSymOffset = ftell(Symfile);
-  if (fread(sym, sizeof(struct symtable), 1, Symfile) != 1) return (-1);
-
-  // Get the symbol name into a separate buffer for now
-  if (sym->name != NULL) {
-    fgetstr(SymText, TEXTLEN + 1, Symfile);
+  // Read in the fixed fields of the next record
+  sym->type = symgetvar();
+  if (sym->type == -1) return (-1);
+  i = symgetvar();
+  sym->class = i >> 4;
+  sym->stype = i & 15;
+  flags = symgetvar();
+  sym->id = symgetvar();
+  sym->ctypeid = symgetvar();
+  sym->size = symgetsvar();
+  sym->nelems = symgetsvar();
+  sym->st_posn = symgetsvar();
+  sym->st_hasaddr = 0;
+  if (flags & SF_HASADDR) sym->st_hasaddr = 1;
+  sym->st_lastuse = 0;
+  sym->st_changed = 0;
+  sym->name = NULL;
+  sym->ctype = NULL;
+  sym->initlist = NULL;
+  sym->next = NULL;
+  sym->member = NULL;
+
+  // If loadit is off, see if the ids match
+  if (loadit == 0 && id != 0 && sym->id == id) loadit = 1;
+
+  // Get the symbol name into a separate buffer for now.
+  // Skip over it if we are not going to look at it
+  Symname = NULL;
+  if (flags & SF_NAME) {
+    len = symgetvar();
+    if (loadit || name != NULL) {
+      Symname = symgetstr();
+      if (Symname == NULL) Symname = SymText;
+    } else
+      symskip(len + 1);
   }
 
 #ifdef DEBUG
-  if (sym->name != NULL)
-    fprintf(stderr, "symoff %ld name %s stype %d\n",
-		lastSymOffset, SymText, sym->stype);
+  if (Symname != NULL)
+    fprintf(stderr, "name %s stype %d\n", Symname, sym->stype);
   else
-    fprintf(stderr, "symoff %ld id %d\n", lastSymOffset, sym->id);
+    fprintf(stderr, "id %d\n", sym->id);
 #endif
 
-  // If loadit is off, see if the ids match. Or,
-  // see if the names are a match and the stype matches.
-  // For the latter, if NOTATYPE match anything which isn't
+  // If loadit is off, see if the names are a match and
+  // the stype matches. If NOTATYPE match anything which isn't
   // a type and which isn't a member, local or param: we are
   // trying to find a variable, enumval or function. findlocl()
   // will find it if it's a local or parameter. We only get
   // here when we are trying to find a global variable,
   // enumval or function.
-  if (loadit == 0) {
-    if (id != 0 && sym->id == id) loadit = 1;
-    if (name != NULL && !strcmp(name, SymText)) {
-      if (stype == S_NOTATYPE && sym->stype < S_STRUCT
-	  		      && sym->class < V_LOCAL) loadit = 1;
-      if (stype >= S_STRUCT && stype == sym->stype) loadit = 1;
-    }
+  if (loadit == 0 && name != NULL && Symname != NULL &&
+      !strcmp(name, Symname)) {
+    if (stype == S_NOTATYPE && sym->stype < S_STRUCT
+			    && sym->class < V_LOCAL) loadit = 1;
+    if (stype >= S_STRUCT && stype == sym->stype) loadit = 1;
   }
 
-  // Yes, we need to load the rest of the symbol
-  if (loadit) {
+  // No match. Skip over any initialisation list
+  // and the member count. Any members are read
+  // as separate records after this one.
+  if (loadit == 0) {
+    if (flags & SF_INIT)
+      for (i = 0; i < sym->nelems; i++)
+	symgetsvar();
+    if (flags & SF_MEMBS)
+      symgetvar();
+    return (0);
+  }
 
-    // Copy the name over.
-    sym->name = strdup(SymText);
+  // Yes, we need to load the rest of the symbol.
+  // Copy the name over.
+  if (Symname != NULL) {
+    sym->name = mkeepstr(Symname);
     if (sym->name == NULL) fatal("Unable to malloc name in loadSym()");
+  }
 
 #ifdef DEBUG
-    if (sym->name == NULL) {
-      fprintf(stderr, "loadSym found %s NONAME id %d loadit %d\n",
-	      Sstring[sym->stype], sym->id, loadit);
-    } else {
-      fprintf(stderr, "loadSym found %s %s id %d loadit %d\n",
-	      Sstring[sym->stype], sym->name, sym->id, loadit);
-    }
+  if (sym->name == NULL) {
+    fprintf(stderr, "loadSym found %s NONAME id %d loadit %d\n",
+	    Sstring[sym->stype], sym->id, loadit);
+  } else {
+    fprintf(stderr, "loadSym found %s %s id %d loadit %d\n",
+	    Sstring[sym->stype], sym->name, sym->id, loadit);
+  }
 #endif
 
-    // Get the initialisation list.
-    if (sym->initlist != NULL) {
-      sym->initlist = (int *) malloc(sym->nelems * sizeof(int));
-      if (sym->initlist == NULL)
-	fatal("Unable to malloc initlist in loadSym()");
-      fread(sym->initlist, sizeof(int), sym->nelems, Symfile);
-    }
-
-    // Stop now if we must not recursively load more nodes
-    if (!recurse) {
-#ifdef DEBUG
-      fprintf(stderr, "loadSym found it - no recursion\n");
-#endif
-      return (1);
-    }
+  // Get the initialisation list.
+  if (flags & SF_INIT) {
+    sym->initlist = (int *) malloc(sym->nelems * sizeof(int));
+    if (sym->initlist == NULL)
+      fatal("Unable to malloc initlist in loadSym()");
+    for (i = 0; i < sym->nelems; i++)
+      sym->initlist[i] = symgetsvar();
+  }
 
-    // For structs, unions and functions load and add
-    // the members (or params/locals) to the member list
-    if (sym->stype == S_STRUCT || sym->stype == S_UNION
-			       || sym->stype == S_FUNCTION) {
-      Mhead = Mtail = NULL;
+  // Get the number of member records which follow
+  nmembs = 0;
+  if (flags & SF_MEMBS)
+    nmembs = symgetvar();
 
-      while (1) {
+  // Stop now if we must not recursively load more nodes
+  if (!recurse) {
 #ifdef DEBUG
-fprintf(stderr, "loadSym: about to try loading members\n");
+    fprintf(stderr, "loadSym found it - no recursion\n");
 #endif
-	memb = (struct symtable *) malloc(sizeof(struct symtable));
-	if (memb == NULL)
-	  fatal("Unable to malloc member in loadSym()");
+    return (1);
+  }
+
+  // For structs, unions and functions load and add
+  // the members (or params/locals) to the member list
+  Mhead = Mtail = NULL;
+  for (i = 0; i < nmembs; i++) {
+    memb = (struct symtable *) malloc(sizeof(struct symtable));
+    if (memb == NULL)
+      fatal("Unable to malloc member in loadSym()");
 #ifdef MEMBDEBUG
 fprintf(stderr, "%p allocated\n", memb);
 #endif
-	// Get the next symbol. Stop when there are no symbols
-	// or when the symbol isn't a member, enumval, param or local
-	if (loadSym(memb, NULL, 0, 0, 1, 0) != 1)
-	  break;
-	if (memb->class != V_LOCAL && memb->class != V_PARAM &&
-	    memb->class != V_MEMBER)
-	  break;
+    if (loadSym(memb, NULL, 0, 0, 1, 0) != 1)
+      fatal("Missing member record in loadSym()");
 #ifdef DEBUG
 fprintf(stderr, "loadSym: appending %s to member list\n", memb->name);
 #endif
-	appendSym(&Mhead, &Mtail, memb);
-      }
-
-      // We found a non-member symbol. Seek back
-      // to where it was and free the unused struct.
-      // Attach the member list to the original symbol.
-      fseek(Symfile, lastSymOffset, SEEK_SET);
-#ifdef DEBUG
-fprintf(stderr, "Seeked to lastSymOffset %ld as non-member id %d\n",
-				lastSymOffset, memb->id);
-#endif
-#ifdef MEMBDEBUG
-fprintf(stderr, "%p freed, unused memb\n", memb);
-#endif
-      free(memb);
-      sym->member = Mhead;
-      Mhead = Mtail = NULL;
-    }
-    return (1);
-  } else {
-    // No match and loadit was 0. Skip over any initialisation list.
-    if (sym->initlist != NULL)
-      fseek(Symfile, sizeof(int) * sym->nelems, SEEK_CUR);
+    appendSym(&Mhead, &Mtail, memb);
   }
-  return (0);
+
+  // Attach the member list to the original symbol
+  sym->member = Mhead;
+  Mhead = Mtail = NULL;
+  return (1);
 }
 
 // Given a name or an id, search the symbol table file for the next
 // symbol that matches. Fill in the node and return true on a match.
 // Otherwise, return false.
 static int findSyminfile(struct symtable *sym, char *name, int id, int stype) {
+  int nextid;
+  long offset;
+#ifndef WRITESYMS
   int res;
+#endif
 
 #ifdef DEBUG
 if (name!=NULL)
@@ -495,14 +1086,41 @@ else
   fprintf(stderr, "findSyminfile: search id %d\n", id);
 #endif
 
-  // Loop over the file starting at the beginning
-  fseek(Symfile, 0, SEEK_SET);
+  // If we have an index file, use it to go straight to the
+  // symbol with this id, or to each symbol in the name's bucket
+  if (Symidxfile != NULL) {
+    if (id != 0) {
+      if (getSymidx(id, &offset, &nextid) == 0) return (0);
+      symseek(offset);
+      if (loadSym(sym, NULL, 0, id, 0, 1) == 1) return (1);
+      return (0);
+    }
+
+    id = Symhash[symhash(name)];
+    while (id != 0) {
+      if (getSymidx(id, &offset, &nextid) == 0) break;
+      symseek(offset);
+      if (loadSym(sym, name, stype, 0, 0, 1) == 1) return (1);
+      id = nextid;
+    }
+#ifdef DEBUG
+    fprintf(stderr, "findSyminfile: not in the index\n");
+#endif
+    return (0);
+  }
+
+#ifndef WRITESYMS
+  // No index, so loop over the sections
+  // starting after the directory. The
+  // parser always has an index
+  mseek(Symfile, Symsectoff[0], SEEK_SET);
   while (1) {
     // Does the next symbol match? Yes, return it
     res = loadSym(sym, name, stype, id, 0, 1);
     if (res == 1) return (1);
     if (res == -1) break;
   }
+#endif
 #ifdef DEBUG
   fprintf(stderr, "findSyminfile: not found\n");
 #endif
@@ -562,8 +1180,10 @@ fprintf(stderr, "Not in local, try the global Symlist\n");
 
     // Not a local, so search the global symbol list.
     for (this = Symhead; this != NULL; this = this->next) {
-      if (id && this->id == id) return (this);
-      if (name && !strcmp(this->name, name)) return (this);
+      if ((id && this->id == id) || (name && !strcmp(this->name, name))) {
+	this->st_lastuse = Symepoch;
+	return (this);
+      }
     }
   }
 
@@ -576,9 +1196,11 @@ fprintf(stderr, "Not in , try the global Typelist\n");
   // Sorry for the double negative :-)
   if (id || !notatype) {
     for (this = Typehead; this != NULL; this = this->next) {
-      if (id && this->id == id) return (this);
-      if (name && !strcmp(this->name, name) && this->stype == stype)
+      if ((id && this->id == id) ||
+	  (name && !strcmp(this->name, name) && this->stype == stype)) {
+	this->st_lastuse = Symepoch;
 	return (this);
+      }
     }
   }
 
@@ -595,13 +1217,14 @@ fprintf(stderr, "Not in , try the global Typelist\n");
   // If we found a match in the file
   if (findSyminfile(sym, name, id, stype)) {
     // Add it to one of the in-memory lists and return it
+    sym->st_lastuse = Symepoch;
     if (sym->stype < S_STRUCT)
       appendSym(&Symhead, &Symtail, sym);
     else
       appendSym(&Typehead, &Typetail, sym);
 
     // If the symbol points at a composite type, find and link it
-    if (sym->ctype != NULL) {
+    if (sym->ctypeid != 0) {
 #ifdef DEBUG
       fprintf(stderr, "About to findSymid on id %d for %s\n", sym->ctypeid,
 	      sym->name);
@@ -611,7 +1234,7 @@ fprintf(stderr, "Not in , try the global Typelist\n");
 
     // If any member symbols point at a composite type, ditto
     for (this = sym->member; this != NULL; this = this->next)
-      if (this->ctype != NULL) {
+      if (this->ctypeid != 0) {
 #ifdef DEBUG
 	fprintf(stderr, "About to member findSymid on id %d for %s\n",
 		this->ctypeid, this->name);
@@ -665,6 +1288,35 @@ struct symtable *findtypedef(char *s) {
   return (findSymbol(s, S_TYPEDEF, 0));
 }
 
+#ifdef FUNCCACHE
+// Add what the code generator uses of a symbol to a hash.
+// We leave out the id, which changes when earlier symbols
+// are added, and a function's end label. If members is set,
+// add the function's parameters and locals as well.
+unsigned long long hashSym(unsigned long long hash,
+			   struct symtable *sym, int members) {
+  struct symtable *memb;
+
+  if (sym->name != NULL)
+    hash = fnvhash(hash, sym->name, strlen(sym->name) + 1);
+  hash = fnvint(hash, sym->type);
+  hash = fnvint(hash, sym->stype);
+  hash = fnvint(hash, sym->class);
+  hash = fnvint(hash, sym->size);
+  hash = fnvint(hash, sym->nelems);
+  hash = fnvint(hash, sym->st_hasaddr);
+  if (sym->stype != S_FUNCTION)
+    hash = fnvint(hash, sym->st_posn);
+  if (sym->ctype != NULL)
+    hash = fnvint(hash, sym->ctype->size);
+
+  if (members)
+    for (memb = sym->member; memb != NULL; memb = memb->next)
+      hash = hashSym(hash, memb, 0);
+  return (hash);
+}
+#endif
+
 // Free a symbol's memory, returning the symbol's next pointer
 struct symtable *freeSym(struct symtable *sym) {
   struct symtable *next, *memb;
@@ -686,7 +1338,7 @@ struct symtable *freeSym(struct symtable *sym) {
   if (sym->initlist != NULL)
     free(sym->initlist);
   if (sym->name != NULL)
-    free(sym->name);
+    mfreestr(sym->name);
   free(sym);
   return (next);
 }
@@ -703,15 +1355,157 @@ void freeSymtable() {
   Membhead = Membtail = Functionid = NULL;
 }
 
-// Loop over the symbol table file.
-// Load in all the types and
-// global/static variables.
+// Return the number of bytes of memory used by a symbol
+static long symSize(struct symtable *sym) {
+  struct symtable *memb;
+  long size;
+
+  size = sizeof(struct symtable);
+  if (sym->name != NULL)
+    size = size + strlen(sym->name) + 1;
+  if (sym->initlist != NULL)
+    size = size + sym->nelems * sizeof(int);
+  for (memb = sym->member; memb != NULL; memb = memb->next)
+    size = size + symSize(memb);
+  return (size);
+}
+
+// Pin a symbol so that it can't be evicted. Also pin the
+// types it refers to, and any cached symbol with the same
+// name, so that a lookup by name finds the same symbol as
+// it would if we searched the symbol file from the start.
+static void pinSym(struct symtable *sym) {
+  struct symtable *this;
+
+  if (sym == NULL || sym->st_lastuse > Symepoch) return;
+  sym->st_lastuse = Symepoch + 1;
+
+  pinSym(sym->ctype);
+  for (this = sym->member; this != NULL; this = this->next)
+    pinSym(this->ctype);
+
+  if (sym->name == NULL) return;
+  for (this = Symhead; this != NULL; this = this->next)
+    if (this->name != NULL && !strcmp(this->name, sym->name))
+      pinSym(this);
+  for (this = Typehead; this != NULL; this = this->next)
+    if (this->name != NULL && !strcmp(this->name, sym->name))
+      pinSym(this);
+}
+
+// Return true if sym refers to the victim symbol
+// or has the same name as the victim symbol
+static int refersSym(struct symtable *sym, struct symtable *victim) {
+  struct symtable *memb;
+
+  if (sym->ctype == victim) return (1);
+  for (memb = sym->member; memb != NULL; memb = memb->next)
+    if (memb->ctype == victim) return (1);
+  if (sym->name != NULL && victim->name != NULL &&
+      !strcmp(sym->name, victim->name)) return (1);
+  return (0);
+}
+
+// Remove a node from the singly-linked list pointed to by head or tail
+static void unlinkSym(struct symtable **head, struct symtable **tail,
+		      struct symtable *node) {
+  struct symtable *prev, *this;
+
+  prev = NULL;
+  for (this = *head; this != NULL; this = this->next) {
+    if (this == node) {
+      if (prev == NULL) *head = this->next;
+      else prev->next = this->next;
+      if (*tail == node) *tail = prev;
+      return;
+    }
+    prev = this;
+  }
+}
+
+// Evict a symbol from the cache and free it. Also evict any
+// symbols which refer to it, so that we don't leave a cached
+// symbol with a dangling ctype pointer. Return the number
+// of bytes that we freed.
+static long evictSym(struct symtable *victim) {
+  struct symtable *this;
+  long size;
+
+#ifdef DEBUG
+  fprintf(stderr, "Evicting %s %s\n", Sstring[victim->stype], victim->name);
+#endif
+  if (victim->stype < S_STRUCT)
+    unlinkSym(&Symhead, &Symtail, victim);
+  else
+    unlinkSym(&Typehead, &Typetail, victim);
+  size = symSize(victim);
+
+  // Keep looking for symbols which refer to the victim
+  // until there are none left
+  while (1) {
+    for (this = Symhead; this != NULL; this = this->next)
+      if (refersSym(this, victim)) break;
+    if (this == NULL)
+      for (this = Typehead; this != NULL; this = this->next)
+	if (refersSym(this, victim)) break;
+    if (this == NULL) break;
+    size = size + evictSym(this);
+  }
+
+  victim->next = NULL;
+  freeSym(victim);
+  return (size);
+}
+
+// Trim the in-memory symbol tables down to SYMCACHESIZE bytes
+// by evicting the least recently used symbols. The current
+// function and anything it refers to are pinned.
+void trimSymtable(void) {
+  struct symtable *this, *victim;
+  long size;
+
+  pinSym(Functionid);
+
+  // Get the size of the cache
+  size = 0;
+  for (this = Symhead; this != NULL; this = this->next)
+    size = size + symSize(this);
+  for (this = Typehead; this != NULL; this = this->next)
+    size = size + symSize(this);
+
+  // Evict the least recently used unpinned symbol until we fit
+  while (size > SYMCACHESIZE) {
+    victim = NULL;
+    for (this = Symhead; this != NULL; this = this->next)
+      if (this->st_lastuse <= Symepoch &&
+	  (victim == NULL || this->st_lastuse < victim->st_lastuse))
+	victim = this;
+    for (this = Typehead; this != NULL; this = this->next)
+      if (this->st_lastuse <= Symepoch &&
+	  (victim == NULL || this->st_lastuse < victim->st_lastuse))
+	victim = this;
+    if (victim == NULL) break;
+    size = size - evictSym(victim);
+  }
+
+  // Start a new epoch. Pinned symbols now have
+  // the new epoch as their last use.
+  Symepoch++;
+  Membhead = Membtail = NULL;
+}
+
+#ifndef WRITESYMS
+// Loop over the types, globals and string literals
+// sections of the symbol table file. Load in all
+// the types and global/static variables.
 void loadGlobals(void) {
   struct symtable *sym;
+  struct symtable *memb;
   int i;
 
-  // Start at the file's beginning. Load all symbols
-  fseek(Symfile, 0, SEEK_SET);
+  // These sections run to the end of the file.
+  // Load all their symbols
+  mseek(Symfile, Symsectoff[SS_TYPES], SEEK_SET);
   while (1) {
     // Load the next symbol + members + initlist
     sym = (struct symtable *) malloc(sizeof(struct symtable));
@@ -722,8 +1516,15 @@ void loadGlobals(void) {
       free(sym); break;
     }
 
-    // Add any type to the type list
+    sym->st_lastuse = Symepoch;
+
+    // Add any type to the type list. Link any
+    // members which point at a composite type.
+    // These types will be earlier in the file.
     if (sym->stype >= S_STRUCT) {
+      for (memb = sym->member; memb != NULL; memb = memb->next)
+	if (memb->ctypeid != 0)
+	  memb->ctype = findSymbol(NULL, 0, memb->ctypeid);
       appendSym(&Typehead, &Typetail, sym); continue;
     }
 
@@ -734,7 +1535,7 @@ void loadGlobals(void) {
       appendSym(&Symhead, &Symtail, sym);
 
       // If the symbol points at a composite type, find and link it
-      if (sym->ctype != NULL) {
+      if (sym->ctypeid != 0) {
 	sym->ctype = findSymbol(NULL, 0, sym->ctypeid);
       }
       continue;
@@ -744,3 +1545,4 @@ void loadGlobals(void) {
     freeSym(sym);
   }
 }
+#endif
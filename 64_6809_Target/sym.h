@@ -14,9 +14,21 @@ struct symtable *findenumtype(char *s);
 struct symtable *findenumval(char *s);
 struct symtable *findtypedef(char *s);
 void loadGlobals(void);
+void loadSymidx(void);
+void saveSymidx(void);
+void startSymfile(void);
+void endSymfile(void);
+int checkSymfile(void);
 struct symtable *freeSym(struct symtable *sym);
 void freeSymtable(void);
+void trimSymtable(void);
 void flushSymtable(void);
 void dumpSymlists(void);
+void saveSymstate(FILE *f);
+void loadSymstate(FILE *f);
+#ifdef FUNCCACHE
+unsigned long long hashSym(unsigned long long hash,
+			   struct symtable *sym, int members);
+#endif
 
 extern struct symtable *Symhead;
@@ -0,0 +1 @@
+#error: Stop here on line 7 of input174.c
@@ -0,0 +1,19 @@
+#include <stdio.h>
+
+// Large and negative initial values
+// go through the symbol file
+long big[]= { 0, 1, -1, 1073741824, -1073741824,
+	      2147483647, -2147483648 };
+int small[]= { 0, 1, -1, 16384, -16385, 32767, -32768 };
+long g= 1073741824;
+
+int main() {
+  int i;
+
+  for (i= 0; i < 7; i++)
+    printf("%ld\n", big[i]);
+  for (i= 0; i < 7; i++)
+    printf("%d\n", small[i]);
+  printf("%ld\n", g);
+  return(0);
+}
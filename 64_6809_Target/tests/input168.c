@@ -0,0 +1,20 @@
+#include <stdio.h>
+
+// Large and negative integer literals
+// go through the AST file
+int main() {
+  long x;
+  int y;
+
+  x= 0x40000000; printf("%ld\n", x);
+  x= 1073741824; printf("%ld\n", x);
+  x= -1073741824; printf("%ld\n", x);
+  x= 2147483647; printf("%ld\n", x);
+  x= -2147483648; printf("%ld\n", x);
+  x= x + 1; printf("%ld\n", x);
+  y= 16384; printf("%d\n", y);
+  y= -16385; printf("%d\n", y);
+  y= 32767; printf("%d\n", y);
+  y= -32768; printf("%d\n", y);
+  return(0);
+}
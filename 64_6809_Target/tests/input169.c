@@ -0,0 +1,33 @@
+#include <stdio.h>
+
+// Object-like and function-like macros
+#define TEN 10
+#define TWENTY (TEN + TEN)
+#define SQUARE(x) ((x) * (x))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define NOARGS() 42
+#define CALL(f, a) f(a)
+#define SUM3(a, b, c) a + b + c
+
+int SELF = 5;
+#define SELF (SELF + 1)
+
+int main() {
+  int i = 3;
+  int MAX = 9;
+
+  printf("%d\n", TEN);
+  printf("%d\n", TWENTY);
+  printf("%d\n", SQUARE(i + 1));
+  printf("%d\n", MAX(TWENTY, SQUARE(5)));
+  printf("%d\n", NOARGS());
+  printf("%d\n", CALL(SQUARE, 7));
+  printf("%d\n", SELF);
+  printf("%d\n", MAX);
+  printf("%d\n", SUM3(SQUARE(2), CALL(SQUARE,
+		   3), (5)));
+#undef TEN
+#define TEN 100
+  printf("%d\n", TWENTY);
+  return(0);
+}
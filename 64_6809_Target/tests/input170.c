@@ -0,0 +1,25 @@
+#include <stdio.h>
+
+// Stringizing with # and pasting with ##
+#define STR(x) #x
+#define XSTR(x) STR(x)
+#define CAT(a, b) a ## b
+#define VAR(n) var ## n
+#define NUM 42
+
+int var1 = 1;
+int var2 = 2;
+
+int main() {
+  int CAT(foo, bar) = 7;
+
+  printf("%s\n", STR(hello   world));
+  printf("%s\n", STR("quoted\n" and 'c'));
+  printf("%s\n", STR(NUM));
+  printf("%s\n", XSTR(NUM));
+  printf("%d\n", foobar);
+  printf("%d\n", VAR(1) + VAR(2));
+  printf("%d\n", CAT(1, 2) + 1);
+  printf("%d\n", CAT(N, UM));
+  return(0);
+}
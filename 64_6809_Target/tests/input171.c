@@ -0,0 +1,71 @@
+#include <stdio.h>
+
+// Nested #if, #elif and #else groups,
+// with expressions and defined()
+#define ONE 1
+#define TWO 2
+#define EMPTY
+
+int main() {
+#if ONE + TWO == 3 && defined(ONE)
+  printf("sum and defined\n");
+#else
+  printf("wrong 1\n");
+#endif
+
+#if defined TWO && !defined(THREE)
+  printf("defined without parentheses\n");
+#endif
+
+#ifdef EMPTY
+  printf("ifdef an empty macro\n");
+#endif
+
+#ifndef THREE
+  printf("ifndef\n");
+#endif
+
+#if UNDEFINED_NAME
+  printf("wrong 2\n");
+#elif (TWO << 3) == 16 && 10 / 3 == 3 && 10 % 3 == 1
+  printf("elif\n");
+#else
+  printf("wrong 3\n");
+#endif
+
+#if 0
+  printf("wrong 4\n");
+#if 1
+  printf("wrong 5\n");
+#else
+  printf("wrong 6\n");
+#endif
+#error This is in a false group
+#unknown directive
+#elif ONE
+# if TWO > ONE ? 1 : 0
+  printf("nested\n");
+#  if -1 < 0 && ~0 == -1 && 'A' == 65
+  printf("unary and char\n");
+#  elif 1
+  printf("wrong 7\n");
+#  endif
+# else
+  printf("wrong 8\n");
+# endif
+#else
+  printf("wrong 9\n");
+#endif
+
+#undef ONE
+#ifdef ONE
+  printf("wrong 10\n");
+#else
+  printf("undef\n");
+#endif
+
+#if 0x10 == 16 && 010 == 8 && 1L
+  printf("hex and octal\n");
+#endif
+  return(0);
+}
@@ -0,0 +1,21 @@
+#include <stdio.h>
+
+// A header which is all one #ifndef group is skipped
+// when its guard is defined, but read again once the
+// guard is #undef'd. A header with more after its
+// #endif is read each time
+int Count;
+
+int main() {
+  Count = 0;
+#include "input172a.h"
+#include "input172a.h"
+  printf("%d\n", Count);
+#undef INPUT172A_H
+#include "input172a.h"
+  printf("%d\n", Count);
+#include "input172b.h"
+#include "input172b.h"
+  printf("%d\n", Count);
+  return(0);
+}
@@ -0,0 +1,6 @@
+/* A guarded header */
+
+#ifndef INPUT172A_H
+#define INPUT172A_H
+  Count = Count + 1;
+#endif
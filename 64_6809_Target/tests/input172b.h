@@ -0,0 +1,4 @@
+#ifndef INPUT172B_H
+#define INPUT172B_H
+#endif
+  Count = Count + 10;
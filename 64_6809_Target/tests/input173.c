@@ -0,0 +1,20 @@
+#include <stdio.h>
+
+// __LINE__, __FILE__ and #line
+#define LINE __LINE__
+#define NEWLINE 2000
+
+int main() {
+  printf("%d\n", __LINE__);
+  printf("%s\n", __FILE__);
+  printf("%d\n", LINE);
+  printf("%d\n",
+    __LINE__);
+#line 500
+  printf("%d %s\n", __LINE__, __FILE__);
+#line 1000 "renamed.c"
+  printf("%d %s\n", __LINE__, __FILE__);
+#line NEWLINE
+  printf("%d %s\n", __LINE__, __FILE__);
+  return(0);
+}
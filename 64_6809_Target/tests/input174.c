@@ -0,0 +1,9 @@
+#include <stdio.h>
+
+#if 0
+#error Not this one
+#endif
+#ifndef NOTDEFINED
+#error Stop here
+#endif
+int main() { return(0); }
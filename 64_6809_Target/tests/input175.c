@@ -0,0 +1,26 @@
+#include <stdio.h>
+
+// Comments and line splices
+#define ADD(a, b) ((a) /* a comment */ + b)	// and another "one
+#define LONG 1 + \
+	     2
+
+int main() {
+  int ab\
+cd = 5;
+  char *s = "no /* comment */ // here";
+  char *t = "spl\
+iced";
+
+  printf("%d\n", ADD(1, /* in the arguments */ 2));
+  printf("%d\n", ADD(abcd,
+		     LONG));
+  printf("%s\n", s);
+  printf("%s\n", t);
+  // A comment which goes \
+  printf("wrong\n");
+  printf("%d\n", __LINE__);
+  /* A comment
+     over lines */ printf("%d\n", __LINE__);
+  return(0);
+}
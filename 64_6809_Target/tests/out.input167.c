@@ -0,0 +1,15 @@
+0
+1
+-1
+1073741824
+-1073741824
+2147483647
+-2147483648
+0
+1
+-1
+16384
+-16385
+32767
+-32768
+1073741824
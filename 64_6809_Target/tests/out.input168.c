@@ -0,0 +1,10 @@
+1073741824
+1073741824
+-1073741824
+2147483647
+-2147483648
+-2147483647
+16384
+-16385
+32767
+-32768
@@ -0,0 +1,10 @@
+10
+20
+16
+25
+42
+49
+6
+9
+18
+200
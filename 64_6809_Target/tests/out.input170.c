@@ -0,0 +1,8 @@
+hello world
+"quoted\n" and 'c'
+NUM
+42
+7
+3
+13
+42
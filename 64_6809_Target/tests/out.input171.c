@@ -0,0 +1,9 @@
+sum and defined
+defined without parentheses
+ifdef an empty macro
+ifndef
+elif
+nested
+unary and char
+undef
+hex and octal
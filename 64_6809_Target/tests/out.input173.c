@@ -0,0 +1,7 @@
+8
+input173.c
+10
+12
+500 input173.c
+1000 renamed.c
+2000 renamed.c
@@ -0,0 +1,6 @@
+3
+8
+no /* comment */ // here
+spliced
+22
+24
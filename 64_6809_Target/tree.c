@@ -13,6 +13,18 @@
 // Used to enumerate the AST nodes
 static int nodeid= 1;
 
+#ifdef PCHFILES
+// Get and set the next AST node id, so
+// that a precompiled header can save it
+int getnodeid(void) {
+  return (nodeid);
+}
+
+void setnodeid(int id) {
+  nodeid= id;
+}
+#endif
+
 // Build and return a generic AST node
 struct ASTnode *mkastnode(int op, int type,
 			  struct symtable *ctype,
@@ -80,7 +92,7 @@ struct ASTnode *mkastunary(int op, int type,
 // Free the given AST node
 void freeASTnode(struct ASTnode *tree) {
   if (tree==NULL) return;
-  if (tree->name != NULL) free(tree->name);
+  if (tree->name != NULL) mfreestr(tree->name);
   free(tree);
 }
 
@@ -95,27 +107,303 @@ void freetree(struct ASTnode *tree, int freenames) {
   if (tree->mid!=NULL) freetree(tree->mid, freenames);
   if (tree->right!=NULL && tree->right!=tree->left)
 					freetree(tree->right, freenames);
-  if (freenames && tree->name != NULL) free(tree->name);
+  if (freenames && tree->name != NULL) mfreestr(tree->name);
   free(tree);
 }
 
 #ifndef WRITESYMS
 
+// Check the header at the start of the AST file.
+// Return 1 if we can read this file's records, 0 otherwise.
+int checkASTfile(void) {
+  char hdr[ASTHDRLEN];
+
+  mseek(Infile, 0, SEEK_SET);
+  if (mread(hdr, 1, ASTHDRLEN, Infile) != ASTHDRLEN) return (0);
+  if (hdr[0] != 'w' || hdr[1] != 'a' || hdr[2] != 't') return (0);
+  if (hdr[3] != ASTVERSION) return (0);
+  return (1);
+}
+
+// Read the AST node record at the current position in the
+// AST file into the given node. Any name is left in Text or
+// in the file's mapping. Return 0 if EOF, 1 otherwise.
+static int readASTnode(struct ASTnode *node) {
+  int flags, i;
+
+  // Read the fields which are always present
+  i= fgetvar(Infile);
+  if (i == -1) return(0);
+  node->op= i >> 1;
+  node->rvalue= i & 1;
+  flags= fgetvar(Infile);
+  node->type= fgetvar(Infile);
+  node->nodeid= fgetvar(Infile);
+
+  // and any of the others
+  node->leftid= node->midid= node->rightid= 0;
+  if (flags & AF_LEFT) node->leftid= node->nodeid + fgetsvar(Infile);
+  if (flags & AF_MID) node->midid= node->nodeid + fgetsvar(Infile);
+  if (flags & AF_RIGHT) node->rightid= node->nodeid + fgetsvar(Infile);
+  node->symid= 0;
+  if (flags & AF_SYMID) node->symid= fgetvar(Infile);
+  node->name= NULL;
+  if (flags & AF_NAME) {
+    fgetvar(Infile);
+    node->name= mgetstr(Text, TEXTLEN + 1, Infile);
+    if (node->name==NULL)
+      fatal("Unexpected EOF in the AST file");
+  }
+  node->a_intvalue= 0;
+  if (flags & AF_VALUE) node->a_intvalue= fgetsvar(Infile);
+  node->linenum= 0;
+  if (flags & AF_LINE) node->linenum= fgetvar(Infile);
+
+  // Set the pointers to NULL to trip us up!
+  node->ctype= NULL;
+  node->sym= NULL;
+  node->left= node->mid= node->right= NULL;
+  return(1);
+}
+
 // We record the id of the last function that we loaded.
 // and the highest index in the array below
 static int lastFuncid= -1;
 static int hiFuncid;
 
-// We also keep an array of AST node offsets that
-// represent the functions in the AST file
-long *Funcoffset;
+// We also keep the table of functions in the AST file
+struct ASTfunc *Functable;
+
+// The nodes are serialised in preorder, so the nodes we want
+// next are usually just after the ones we last read from the
+// AST file. Aheadnode holds a window of up to AHEADSIZE records
+// read in one after the other, oldest first. The AST file is
+// positioned just after the newest one. The window is emptied
+// whenever the AST file is positioned elsewhere.
+#ifndef AHEADSIZE
+#define AHEADSIZE 16
+#endif
+static struct ASTnode *Aheadnode= NULL;
+static int Aheadfirst= 0;
+static int Aheadcount= 0;
+
+#ifdef ASTSTATS
+// Count how the nodes were found: resident,
+// read ahead, or through the AST index file
+static long Reshits= 0;
+static long Aheadhits= 0;
+static long Idxloads= 0;
+#endif
+
+// Empty the read-ahead window
+static void clearahead(void) {
+  struct ASTnode *n;
+
+  while (Aheadcount > 0) {
+    n= Aheadnode + Aheadfirst;
+    if (n->name != NULL) mfreestr(n->name);
+    Aheadfirst= (Aheadfirst + 1) % AHEADSIZE;
+    Aheadcount--;
+  }
+  Aheadfirst= 0;
+}
+
+// Read the record at the current position in the AST file into
+// the read-ahead window, dropping the oldest record if the window
+// is full. Return a pointer to it, or NULL if EOF
+static struct ASTnode *readahead(void) {
+  struct ASTnode *n;
+
+  if (Aheadnode==NULL) {
+    Aheadnode= (struct ASTnode *)malloc(AHEADSIZE * sizeof(struct ASTnode));
+    if (Aheadnode==NULL)
+      fatal("Cannot malloc the read-ahead AST nodes");
+  }
+
+  // Drop the oldest record if the window is full
+  if (Aheadcount==AHEADSIZE) {
+    n= Aheadnode + Aheadfirst;
+    if (n->name != NULL) mfreestr(n->name);
+    Aheadfirst= (Aheadfirst + 1) % AHEADSIZE;
+    Aheadcount--;
+  }
+
+  n= Aheadnode + ((Aheadfirst + Aheadcount) % AHEADSIZE);
+  if (readASTnode(n)==0) return(NULL);
+  if (n->name != NULL) {
+    n->name= mkeepstr(n->name);
+    if (n->name==NULL)
+      fatal("Unable to malloc string literal in readahead()");
+  }
+  Aheadcount++;
+  return(n);
+}
+
+// Find the AST node with the given id in the read-ahead
+// window. If it isn't there, read on through the AST file
+// for up to AHEADSIZE records. Return NULL if not found
+static struct ASTnode *findahead(int id) {
+  struct ASTnode *n;
+  int i;
+
+  if (Aheadcount==0) return(NULL);
+  for (i= 0; i < Aheadcount; i++) {
+    n= Aheadnode + ((Aheadfirst + i) % AHEADSIZE);
+    if (n->nodeid==id) return(n);
+  }
+
+  for (i= 0; i < AHEADSIZE; i++) {
+    n= readahead();
+    if (n==NULL) return(NULL);
+    if (n->nodeid==id) return(n);
+  }
+  return(NULL);
+}
+
+#ifndef DETREE
+// When all of a function's AST nodes fit in ASTBUDGET bytes,
+// we read them in together when we load its A_FUNCTION node.
+// Resnode holds the nodes with ids Reslo to Reshi; an entry with
+// nodeid zero is not part of the function. Without a resident
+// function, each node is read from the AST file as needed.
+#ifndef ASTBUDGET
+#define ASTBUDGET 2048
+#endif
+static struct ASTnode *Resnode= NULL;
+static int Reslo, Reshi;
+static struct ASTnode Readnode;
+
+// Free the resident AST nodes
+static void freeFuncnodes(void) {
+  int i;
+
+  if (Resnode==NULL) return;
+  for (i= 0; i <= Reshi - Reslo; i++)
+    if (Resnode[i].nodeid != 0 && Resnode[i].name != NULL)
+      mfreestr(Resnode[i].name);
+  free(Resnode);
+  Resnode= NULL;
+}
+
+// Read in all the AST nodes for the function
+// at position posn in the function table if
+// they fit in the budget
+static void loadFuncnodes(int posn) {
+  struct ASTfunc *func;
+  struct ASTnode *node;
+  long start, size;
+  int i, count;
+
+  freeFuncnodes();
+
+  // The function's nodes start where
+  // the previous function's nodes end
+  func= Functable + posn;
+  if (posn==0)
+    start= ASTHDRLEN;
+  else
+    start= Functable[posn - 1].end;
+
+  // See if the nodes and their names fit in the budget
+  count= func->hiid - func->loid + 1;
+  if (count <= 0) return;
+  size= count;
+  size= size * sizeof(struct ASTnode);
+  size= size + func->end - start;
+  if (size > ASTBUDGET) return;
+
+  Resnode= (struct ASTnode *)malloc(count * sizeof(struct ASTnode));
+  if (Resnode==NULL) return;
+  Reslo= func->loid; Reshi= func->hiid;
+  for (i= 0; i < count; i++)
+    Resnode[i].nodeid= 0;
+
+  // Read the nodes in one after the other. If a node
+  // appears twice, the last one wins as in the index
+  clearahead();
+  mseek(Infile, start, SEEK_SET);
+  while (mtell(Infile) < func->end) {
+    if (readASTnode(&Readnode) == 0) break;
+    if (Readnode.nodeid < Reslo || Readnode.nodeid > Reshi) continue;
+
+    node= Resnode + (Readnode.nodeid - Reslo);
+    if (node->nodeid != 0 && node->name != NULL)
+      mfreestr(node->name);
+    memcpy(node, &Readnode, sizeof(struct ASTnode));
+    if (node->name != NULL) {
+      node->name= mkeepstr(node->name);
+      if (node->name==NULL)
+	fatal("Unable to malloc string literal in loadFuncnodes()");
+    }
+  }
+}
+
+// Return a pointer to the resident AST node
+// with the given id, or NULL if it isn't resident
+static struct ASTnode *findResnode(int id) {
+  if (Resnode==NULL || id < Reslo || id > Reshi) return(NULL);
+  if (Resnode[id - Reslo].nodeid != id) return(NULL);
+  return(Resnode + (id - Reslo));
+}
+
+#ifdef FUNCCACHE
+// Add the AST nodes of the function we last loaded to the
+// hash. Node ids and line numbers are taken relative to the
+// function's first ones, and symbols are added by what they
+// hold and not by their ids, so that a function which has
+// only moved in the file hashes the same. Set *baseline to
+// the first line number.
+unsigned long long hashFuncnodes(unsigned long long hash, int *baseline) {
+  struct ASTfunc *func;
+  struct symtable *sym;
+  struct ASTnode *n;
+  long start;
+
+  func= Functable + lastFuncid;
+  if (lastFuncid==0)
+    start= ASTHDRLEN;
+  else
+    start= Functable[lastFuncid - 1].end;
+
+  // We move the AST file, so empty the read-ahead window
+  *baseline= 0;
+  n= &Readnode;
+  clearahead();
+  mseek(Infile, start, SEEK_SET);
+  while (mtell(Infile) < func->end) {
+    if (readASTnode(n) == 0) break;
+    if (*baseline==0) *baseline= n->linenum;
+
+    hash= fnvint(hash, n->op * 2 + n->rvalue);
+    hash= fnvint(hash, n->type);
+    hash= fnvint(hash, n->nodeid - func->loid);
+    hash= fnvint(hash, n->leftid ? n->leftid - func->loid : -1);
+    hash= fnvint(hash, n->midid ? n->midid - func->loid : -1);
+    hash= fnvint(hash, n->rightid ? n->rightid - func->loid : -1);
+    hash= fnvint(hash, n->a_intvalue);
+    hash= fnvint(hash, n->linenum ? n->linenum - *baseline : 0);
+    if (n->name==NULL) continue;
+
+    // The symbol search can reuse Text, so
+    // hash the name before we find the symbol
+    hash= fnvhash(hash, n->name, strlen(n->name) + 1);
+    if (n->op == A_STRLIT) continue;
+    sym= findSymbol(NULL, 0, n->symid);
+    if (sym==NULL)
+      fatald("Can't find symbol with id", n->symid);
+    hash= hashSym(hash, sym, n->op == A_FUNCTION);
+  }
+  return(hash);
+}
+#endif
+#endif
 
 // Given an AST node id, load that AST node from the AST file.
 // If nextfunc is set, find the next AST node which is a function.
 // Allocate and return the node or NULL if it can't be found.
 struct ASTnode *loadASTnode(int id, int nextfunc) {
   long offset, idxoff;
-  struct ASTnode *node;
+  struct ASTnode *node, *found;
 
   // Do nothing if nothing to do
   if (id==0 && nextfunc==0) return(NULL);
@@ -132,13 +420,16 @@ struct ASTnode *loadASTnode(int id, int nextfunc) {
   // use the AST index file otherwise
   if (nextfunc==1) {
     lastFuncid++;
-    if (lastFuncid > hiFuncid)
+    if (lastFuncid > hiFuncid) {
+#ifndef DETREE
+      freeFuncnodes();
+#endif
       return(NULL);
-    offset= Funcoffset[lastFuncid];
-  } else {
-    idxoff= id * sizeof(long);
-    fseek(Idxfile, idxoff, SEEK_SET);
-    fread(&offset, sizeof(long), 1, Idxfile);
+    }
+    offset= Functable[lastFuncid].offset;
+#ifndef DETREE
+    loadFuncnodes(lastFuncid);
+#endif
   }
 
   // Allocate a node
@@ -146,22 +437,53 @@ struct ASTnode *loadASTnode(int id, int nextfunc) {
   if (node==NULL)
     fatal("Cannot malloc an AST node in loadASTnode");
 
-  // Read the node in from the AST file. Give up if EOF
-  fseek(Infile, offset, SEEK_SET);
-  if (fread(node, sizeof(struct ASTnode), 1, Infile)!=1) {
-    free(node); return(NULL);
+  // Copy the node if it is resident,
+  // or if it is in the read-ahead window
+  found= NULL;
+#ifndef DETREE
+  if (nextfunc==0) found= findResnode(id);
+#endif
+#ifdef ASTSTATS
+  if (found!=NULL) Reshits++;
+#endif
+  if (found==NULL && nextfunc==0) {
+    found= findahead(id);
+#ifdef ASTSTATS
+    if (found!=NULL) Aheadhits++;
+#endif
   }
 
+  if (found==NULL) {
+    // Otherwise find its offset in the AST index file
+    if (nextfunc==0) {
+      idxoff= id * sizeof(long);
+      mseek(Idxfile, idxoff, SEEK_SET);
+      mread(&offset, sizeof(long), 1, Idxfile);
+    }
+
+    // Read the node in from the AST file,
+    // starting a new window. Give up if EOF
+    clearahead();
+    mseek(Infile, offset, SEEK_SET);
+    found= readahead();
+    if (found==NULL) {
+      free(node); return(NULL);
+    }
+#ifdef ASTSTATS
+    Idxloads++;
+#endif
+  }
+  memcpy(node, found, sizeof(struct ASTnode));
+
 #ifdef DEBUG
   // Check that the node we loaded was the one we wanted
   if (id!=0 && id!=node->nodeid)
     fprintf(stderr, "Wanted AST node id %d, got %d\n", id, node->nodeid);
 #endif
 
-  // If there is a string/identifier literal, get it
+  // If there is a string/identifier literal, keep it
   if (node->name!=NULL) {
-    fgetstr(Text, TEXTLEN + 1, Infile);
-    node->name= strdup(Text);
+    node->name= mkeepstr(node->name);
     if (node->name==NULL)
       fatal("Unable to malloc string literal in deserialiseAST()");
 
@@ -176,9 +498,6 @@ struct ASTnode *loadASTnode(int id, int nextfunc) {
 #endif
   }
 
-  // Set the pointers to NULL to trip us up!
-  node->left= node->mid= node->right= NULL;
-
 #ifndef DETREE
   // If this is a function, set the global
   // Functionid and create an endlabel for it.
@@ -196,6 +515,42 @@ struct ASTnode *loadASTnode(int id, int nextfunc) {
   return(node);
 }
 
+#ifndef DETREE
+// Load the table of function offsets which
+// the parser left at the end of the AST index file
+void loadASTidx(void) {
+  long posn;
+  int count;
+
+  mseek(Idxfile, 0, SEEK_SET);
+  mread(&posn, sizeof(long), 1, Idxfile);
+  mseek(Idxfile, posn, SEEK_SET);
+  if (mread(&count, sizeof(int), 1, Idxfile) != 1)
+    fatal("Unable to read the function table in the AST index file");
+
+  Functable= (struct ASTfunc *)malloc((count+1) * sizeof(struct ASTfunc));
+  if (Functable==NULL)
+    fatal("Cannot malloc the function table in loadASTidx");
+  mread(Functable, sizeof(struct ASTfunc), count, Idxfile);
+
+  // Reset before we start using the array
+  hiFuncid= count - 1; lastFuncid= -1;
+}
+
+#ifdef ASTSTATS
+// Print out how the AST nodes were found
+void printASTstats(void) {
+  long total;
+
+  total= Reshits + Aheadhits + Idxloads;
+  if (total==0) total= 1;
+  fprintf(stderr, "AST nodes: %ld resident, %ld read ahead, %ld by index\n",
+	  Reshits, Aheadhits, Idxloads);
+  fprintf(stderr, "AST nodes found without a seek: %ld%%\n",
+	  ((Reshits + Aheadhits) * 100) / total);
+}
+#endif
+#else
 // Using the open AST file and the newly-created
 // index file, build a list of AST file offsets
 // for each AST node in the AST file.
@@ -203,41 +558,32 @@ void mkASTidxfile(void) {
   struct ASTnode *node;
   long offset, idxoff;
 
-  // Allocate a node and at least some Funcoffset area
+  // Allocate a node and at least some Functable area
   node= (struct ASTnode *)malloc(sizeof(struct ASTnode));
-  Funcoffset= (long *)malloc(sizeof(long));
-  if (node==NULL || Funcoffset==NULL)
+  Functable= (struct ASTfunc *)malloc(sizeof(struct ASTfunc));
+  if (node==NULL || Functable==NULL)
     fatal("Cannot malloc an AST node in loadASTnode");
 
+  // Start with the first node after the header
+  mseek(Infile, ASTHDRLEN, SEEK_SET);
   while (1) {
     // Get the current offset
-    offset = ftell(Infile);
+    offset = mtell(Infile);
 #ifdef DEBUG
-    if (sizeof(long)==4)
-      fprintf(stderr, "A offset %ld sizeof ASTnode %d\n", offset,
-			sizeof(struct ASTnode));
-    else
-      fprintf(stderr, "A offset %ld sizeof ASTnode %ld\n", offset,
-			sizeof(struct ASTnode));
+    fprintf(stderr, "A offset %ld\n", offset);
 #endif
 
     // Read in the next node, stop if none
-    if (fread(node, sizeof(struct ASTnode), 1, Infile)!=1) {
+    if (readASTnode(node)==0) {
       break;
     }
 #ifdef DEBUG
     fprintf(stderr, "Node %d at offset %ld\n", node->nodeid, offset);
     fprintf(stderr, "Node %d left %d mid %d right %d\n", node->nodeid,
         node->leftid, node->midid, node->rightid);
+    if (node->name!=NULL)
+      fprintf(stderr, "  name %s\n", node->name);
 #endif
-
-    // If there is a string/identifier literal, get it
-    if (node->name!=NULL) {
-      fgetstr(Text, TEXTLEN + 1, Infile);
-#ifdef DEBUG
-    fprintf(stderr, "  name %s\n", Text);
-#endif
-    }
     
     // Save the node's offset at its index position in the file.
     idxoff= node->nodeid * sizeof(long);
@@ -249,8 +595,9 @@ void mkASTidxfile(void) {
     // of the function index array and save the offset
     if (node->op==A_FUNCTION) {
       lastFuncid++;
-      Funcoffset= (long *)realloc(Funcoffset, sizeof(long)* (lastFuncid+1));
-      Funcoffset[lastFuncid]= offset;
+      Functable= (struct ASTfunc *)realloc(Functable,
+				sizeof(struct ASTfunc)* (lastFuncid+1));
+      Functable[lastFuncid].offset= offset;
     }
   }
 
@@ -258,4 +605,5 @@ void mkASTidxfile(void) {
   hiFuncid= lastFuncid; lastFuncid= -1;
   free(node);
 }
+#endif // DETREE
 #endif // WRITESYMS
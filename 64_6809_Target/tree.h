@@ -5,4 +5,12 @@ struct ASTnode *mkastunary(int op, int type, struct symtable *ctype, struct ASTn
 void freeASTnode(struct ASTnode *tree);
 void freetree(struct ASTnode *tree, int freenames);
 struct ASTnode *loadASTnode(int id, int nextfunc);
+int checkASTfile(void);
+void loadASTidx(void);
+void printASTstats(void);
 void mkASTidxfile(void);
+int getnodeid(void);
+void setnodeid(int id);
+#ifdef FUNCCACHE
+unsigned long long hashFuncnodes(unsigned long long hash, int *baseline);
+#endif
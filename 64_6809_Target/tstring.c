@@ -11,5 +11,6 @@ char *Tstring[] = {
   "case", "default", "sizeof", "static",
   "intlit", "strlit", ";", "identifier",
   "{", "}", "(", ")", "[", "]", ",", ".",
-  "->", ":", "...", "charlit", "filename", "linenum"
+  "->", ":", "...", "charlit", "filename", "linenum",
+  "iddef", "idref", "lineinc", "lineadv"
 };
@@ -1,9 +1,36 @@
+#ifdef INPROCESS
+#define _GNU_SOURCE		// for memfd_create()
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <unistd.h>
 #include <string.h>
 #include <sys/wait.h>
+#ifdef INPROCESS
+#include <sys/mman.h>
+#endif
+#ifdef TIMEREPORT
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#endif
+#ifdef PCHFILES
+#include <sys/stat.h>
+#endif
+#ifdef COMPCACHE
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <utime.h>
+#endif
+#ifdef COMPSERVER
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
 #include "dirs.h"
 #include "wcc.h"
 
@@ -33,8 +60,19 @@ int cpu = CPU_QBE;		// What CPU/platform we are targetting
 int last_phase = LINK_PHASE;	// Which is the last phase
 int verbose = 0;		// Print out the phase details?
 int keep_tempfiles = 0;		// Keep temporary files?
+int pipe_phases = 0;		// Run the scanner and parser through a pipe?
+int jobs = 1;			// How many files to compile at once
+int running = 0;		// Number of jobs running now
+int jobfailed = 0;		// Has any job failed?
+int injob = 0;			// Are we a job started by start_job()?
+#ifdef PCHFILES
+char *pchdir = NULL;		// Precompiled header directory, or NULL
+#endif
 char *outname = NULL;		// Output filename, if any
 char *initname;			// File name given to us
+int makedeps = 0;		// Write a make dependency file?
+int depphony = 0;		// With a phony target for each header?
+char *depname = NULL;		// Its name from -MF, if any
 
 				// List of commands and object files
 char **phasecmd;
@@ -55,6 +93,82 @@ struct filelist *Objhead, *Objtail;
 char *cmdarg[MAXCMDARGS];	// List of arguments to a command
 int cmdcount = 0;		// Number of command arguments
 
+#ifdef INPROCESS
+// On the host, the scanner, parsers and code generators are
+// linked into wcc (see the Makefile). Each one still runs in
+// its own child process, but we don't exec a new program, and
+// the files between the phases are kept in memory.
+int cscan_main(int argc, char **argv);
+int cparseqbe_main(int argc, char **argv);
+int cgenqbe_main(int argc, char **argv);
+int cparse6809_main(int argc, char **argv);
+int cgen6809_main(int argc, char **argv);
+int cpeep_main(int argc, char **argv);
+
+struct linkedphase {
+  char *name;				// Program name of the phase
+  int (*main)(int argc, char **argv);	// and its linked-in main()
+};
+
+struct linkedphase Linkedphase[] = {
+  { "cscan", cscan_main },
+  { "cparseqbe", cparseqbe_main },
+  { "cgenqbe", cgenqbe_main },
+  { "cparse6809", cparse6809_main },
+  { "cgen6809", cgen6809_main },
+  { "cpeep", cpeep_main },
+  { NULL, NULL }
+};
+
+				// In-memory files for the current
+				// input file, closed once it is done
+#define MAXMEMFILES 10
+int memfd[MAXMEMFILES];
+int memfdcount = 0;
+#endif
+
+#ifdef COMPCACHE
+// On the host, wcc can keep the assembly output for each
+// C file's token stream in a cache directory, and reuse it
+// instead of running the parser, code generator and QBE
+// or the peephole optimiser again. With FUNCCACHE, the code
+// generator and the peephole optimiser keep each function's
+// code there as well.
+#ifndef CACHELIMIT
+#define CACHELIMIT 67108864	// Bytes in the cache before we evict
+#endif
+char *cachedir = NULL;		// Cache directory, NULL if not caching
+void cache_report(void);
+#endif
+
+#ifdef TIMEREPORT
+// On the host, -ftime-report makes wcc record the time and
+// resources used by each phase and print them out at the end.
+// The records live in a shared mapping so that the -j jobs
+// can add to them. They hold copies of the names, as other
+// processes can't follow pointers into our memory.
+#define TIMENAMELEN 256
+struct phasetime {
+  char phase[TIMENAMELEN];	// Name of the phase program
+  char file[TIMENAMELEN];	// Input file being compiled
+  int pid;			// Process id while it runs
+  double start;			// Wall clock time at its start
+  double wall;			// Elapsed wall clock seconds
+  double user;			// User CPU seconds
+  double sys;			// System CPU seconds
+  long maxrss;			// Peak resident set size in Kbytes
+  long outbytes;		// Sizes of the files it wrote
+  char outname[TIMENAMELEN];	// Name of its output file, or empty
+};
+
+#define MAXPHASETIMES 1000
+int timereport = 0;		// 1 for a table, 2 for CSV
+struct phasetime *Phasetime;	// The shared records
+int *Phasecount;		// and how many are in use
+int lasttime = -1;		// Our last record, or -1
+void time_report(void);
+#endif
+
 // Alter the last letter of the initial filename
 char *alter_suffix(char ch) {
   char *str = strdup(initname);
@@ -73,10 +187,37 @@ void addtmpname(char *name) {
   else { Tmptail->next = this; Tmptail = this; }
 }
 
+// Wait for one of the running jobs
+// to finish and note if it failed
+void wait_job(void) {
+  int wstatus;
+
+  if (waitpid(-1, &wstatus, 0) == -1) {
+    fprintf(stderr, "waitpid failed\n");
+    exit(1);
+  }
+  running--;
+  if (WIFEXITED(wstatus) == 0) jobfailed = 1;
+  else if (WEXITSTATUS(wstatus) != 0) jobfailed = 1;
+}
+
 // Remove temporary files and exit
 void Exit(int val) {
   struct filelist *this;
 
+  // Let any running jobs finish before
+  // we remove the temporary files
+  while (running > 0)
+    wait_job();
+#ifdef COMPCACHE
+  if (verbose && cachedir != NULL && injob == 0)
+    cache_report();
+#endif
+#ifdef TIMEREPORT
+  if (timereport && injob == 0)
+    time_report();
+#endif
+
   if (keep_tempfiles == 0)
     for (this = Tmphead; this != NULL; this = this->next)
       unlink(this->name);
@@ -158,17 +299,515 @@ char *newtempfile(char *origname, char *suffix) {
   return (NULL);
 }
 
+#ifdef INPROCESS
+// Given a filename and a desired suffix, return the
+// name of an in-memory file which can be written to.
+// Fall back to a temporary file if we are keeping
+// the temporary files or an in-memory file can't be made.
+char *newmemfile(char *origname, char *suffix) {
+  char *name;
+  int fd;
+
+  if (keep_tempfiles || memfdcount == MAXMEMFILES)
+    return (newtempfile(origname, suffix));
+  fd = memfd_create(suffix, 0);
+  if (fd == -1)
+    return (newtempfile(origname, suffix));
+
+  // The phases open the file by name, and they
+  // inherit the descriptor from us
+  name = (char *) malloc(30);
+  sprintf(name, "/proc/self/fd/%d", fd);
+  memfd[memfdcount++] = fd;
+  return (name);
+}
+
+// Close the in-memory files of the last input file
+void close_memfiles(void) {
+  int i;
+
+  for (i = 0; i < memfdcount; i++)
+    close(memfd[i]);
+  memfdcount = 0;
+}
+
+// Return the linked-in phase which
+// runs the command cmd, or NULL
+struct linkedphase *findlinked(char *cmd) {
+  char *name;
+  int i;
+
+  name = strrchr(cmd, '/');
+  name = (name == NULL) ? cmd : name + 1;
+  for (i = 0; Linkedphase[i].name != NULL; i++)
+    if (!strcmp(name, Linkedphase[i].name))
+      return (Linkedphase + i);
+  return (NULL);
+}
+#else
+#define newmemfile(origname, suffix) newtempfile(origname, suffix)
+#endif
+
+#ifdef COMPCACHE
+// A cache entry is named by a 64-bit FNV-1a hash of the
+// tokens, the CPU, the -D flags and the identities
+// of the phase programs. If any of these change, we miss.
+// Entries are evicted least recently used first: a hit
+// updates the entry's modification time.
+
+unsigned long long cachehash;
+
+// Add len bytes from buf to the cache hash
+void hash_bytes(char *buf, int len) {
+  int i;
+
+  for (i = 0; i < len; i++) {
+    cachehash ^= (unsigned char) buf[i];
+    cachehash *= 1099511628211ULL;
+  }
+}
+
+// Add a string to the cache hash
+void hash_string(char *str) {
+  hash_bytes(str, strlen(str) + 1);
+}
+
+// Add the identity of the program which runs
+// the command cmd to the cache hash: its name,
+// inode, size and last modification time
+void hash_program(char *cmd) {
+  struct stat sb;
+  char path[1024], id[100];
+  char *dirs, *next;
+  int len, found = 0;
+
+#ifdef INPROCESS
+  // A linked-in phase is part of us
+  if (findlinked(cmd) != NULL)
+    cmd = "/proc/self/exe";
+#endif
+
+  hash_string(cmd);
+  if (strchr(cmd, '/') != NULL) {
+    found = (stat(cmd, &sb) == 0);
+  } else {
+    // Search the PATH for the program
+    dirs = getenv("PATH");
+    while (dirs != NULL && found == 0) {
+      next = strchr(dirs, ':');
+      len = (next == NULL) ? strlen(dirs) : next - dirs;
+      snprintf(path, sizeof(path), "%.*s/%s", len, dirs, cmd);
+      found = (stat(path, &sb) == 0);
+      dirs = (next == NULL) ? NULL : next + 1;
+    }
+  }
+
+  if (found) {
+    snprintf(id, sizeof(id), "%lu %lld %lld", (unsigned long) sb.st_ino,
+	     (long long) sb.st_size, (long long) sb.st_mtime);
+    hash_string(id);
+  }
+}
+
+// Return the name of the cache entry for the
+// token file, or NULL if we can't read it
+char *cache_entry(char *tokname) {
+  FILE *fh;
+  char buf[4096];
+  char *name;
+  int i, n;
+
+  cachehash = 14695981039346656037ULL;
+  fh = fopen(tokname, "r");
+  if (fh == NULL) return (NULL);
+  while ((n = fread(buf, 1, sizeof(buf), fh)) > 0)
+    hash_bytes(buf, n);
+  fclose(fh);
+
+  hash_string(cpu == CPU_QBE ? "qbe" : "6809");
+  for (i = 0; i < cppxindex; i++)
+    hash_string(cppextra[i]);
+  for (i = TOK_PHASE; i <= QBEPEEP_PHASE; i++)
+    if (phasecmd[i] != NULL)
+      hash_program(phasecmd[i]);
+  if (cpu == CPU_6809)
+    hash_program(LIB6809DIR "/rules.6809");
+
+  name = (char *) malloc(strlen(cachedir) + 20);
+  sprintf(name, "%s/%016llx.s", cachedir, cachehash);
+  return (name);
+}
+
+// Copy a file. Return 1 if successful, 0 if not
+int copy_file(char *from, char *to) {
+  FILE *in, *out;
+  char buf[4096];
+  int n, ok = 1;
+
+  in = fopen(from, "r");
+  if (in == NULL) return (0);
+  out = fopen(to, "w");
+  if (out == NULL) { fclose(in); return (0); }
+  while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+    if (fwrite(buf, 1, n, out) != n) ok = 0;
+  if (ferror(in)) ok = 0;
+  fclose(in);
+  if (fclose(out) != 0) ok = 0;
+  return (ok);
+}
+
+// Add a hit or a miss to the counts
+// kept in the cache's stats file
+void cache_count(int hit) {
+  char name[1024];
+  long hits = 0, misses = 0;
+  FILE *fh;
+  int fd;
+
+  snprintf(name, sizeof(name), "%s/stats", cachedir);
+  fd = open(name, O_RDWR | O_CREAT, 0666);
+  if (fd == -1) return;
+  fh = fdopen(fd, "r+");
+  flock(fd, LOCK_EX);
+  if (fscanf(fh, "%ld %ld", &hits, &misses) != 2) {
+    hits = 0; misses = 0;
+  }
+  if (hit) hits++;
+  else misses++;
+  rewind(fh);
+  fprintf(fh, "%ld %ld\n", hits, misses);
+  fflush(fh);
+  flock(fd, LOCK_UN);
+  fclose(fh);
+}
+
+// Print out the cache's hit and miss counts
+void cache_report(void) {
+  char name[1024];
+  long hits = 0, misses = 0;
+  FILE *fh;
+
+  snprintf(name, sizeof(name), "%s/stats", cachedir);
+  fh = fopen(name, "r");
+  if (fh == NULL) return;
+  if (fscanf(fh, "%ld %ld", &hits, &misses) == 2)
+    fprintf(stderr, "Cache %s: %ld hits, %ld misses\n", cachedir,
+	    hits, misses);
+  fclose(fh);
+}
+
+// Copy the cache entry to asmname if it exists.
+// Return 1 on a hit, 0 on a miss
+int cache_fetch(char *entry, char *asmname) {
+  if (entry != NULL && copy_file(entry, asmname)) {
+    utime(entry, NULL);
+    cache_count(1);
+    if (verbose)
+      fprintf(stderr, "Cache hit for %s: %s\n", initname, entry);
+    return (1);
+  }
+  cache_count(0);
+  if (verbose)
+    fprintf(stderr, "Cache miss for %s\n", initname);
+  return (0);
+}
+
+// An entry in the cache directory
+struct cachefile {
+  char *name;
+  long size;
+  long mtime;
+};
+
+// Compare two cache entries by age, oldest first
+static int cmp_mtime(const void *a, const void *b) {
+  long ta = ((struct cachefile *) a)->mtime;
+  long tb = ((struct cachefile *) b)->mtime;
+  return ((ta > tb) - (ta < tb));
+}
+
+// Return 1 if name is a cache entry. Whole files
+// end in .s, and functions from cgen and cpeep end
+// in .gs and .ps. Temporary files end in a pid
+int is_cache_entry(char *name) {
+  int len = strlen(name);
+
+  if (endswith(name, 's')) return (1);
+  if (len < 3 || name[len - 1] != 's' || name[len - 3] != '.')
+    return (0);
+  return (name[len - 2] == 'g' || name[len - 2] == 'p');
+}
+
+// Remove the least recently used cache
+// entries until the cache fits in CACHELIMIT
+void cache_evict(void) {
+  struct cachefile *list = NULL;
+  struct dirent *dent;
+  struct stat sb;
+  char name[1024];
+  int count = 0, max = 0, i;
+  long total = 0;
+  DIR *dir;
+
+  dir = opendir(cachedir);
+  if (dir == NULL) return;
+  while ((dent = readdir(dir)) != NULL) {
+    if (!is_cache_entry(dent->d_name)) continue;
+    snprintf(name, sizeof(name), "%s/%s", cachedir, dent->d_name);
+    if (stat(name, &sb) == -1) continue;
+    if (count == max) {
+      max = max ? 2 * max : 64;
+      list = (struct cachefile *) realloc(list, max * sizeof(struct cachefile));
+    }
+    list[count].name = strdup(name);
+    list[count].size = sb.st_size;
+    list[count].mtime = sb.st_mtime;
+    total += sb.st_size;
+    count++;
+  }
+  closedir(dir);
+
+  qsort(list, count, sizeof(struct cachefile), cmp_mtime);
+  for (i = 0; i < count && total > CACHELIMIT; i++) {
+    if (verbose)
+      fprintf(stderr, "Cache evicting %s\n", list[i].name);
+    unlink(list[i].name);
+    total -= list[i].size;
+  }
+  for (i = 0; i < count; i++)
+    free(list[i].name);
+  free(list);
+}
+
+// Put a copy of asmname into the cache as entry.
+// Write it to a temporary name first, so that
+// concurrent compiles never see a partial entry
+void cache_store(char *entry, char *asmname) {
+  char *tmpname;
+
+  if (entry == NULL) return;
+  tmpname = (char *) malloc(strlen(entry) + 20);
+  sprintf(tmpname, "%s.%d", entry, getpid());
+  if (copy_file(asmname, tmpname) && rename(tmpname, entry) == 0)
+    cache_evict();
+  else
+    unlink(tmpname);
+  free(tmpname);
+}
+#endif
+
+#ifdef TIMEREPORT
+// Return the wall clock time in seconds
+double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+// Make the shared records for the time report
+void init_timing(void) {
+  void *area;
+
+  area = mmap(NULL, sizeof(int) + MAXPHASETIMES * sizeof(struct phasetime),
+	      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (area == MAP_FAILED) {
+    fprintf(stderr, "Unable to make the time report records\n");
+    Exit(1);
+  }
+  Phasecount = (int *) area;
+  Phasetime = (struct phasetime *) (Phasecount + 1);
+}
+
+// Start a record for the command in cmdarg[],
+// which is running as process pid. out is the
+// file which it writes on stdout, or NULL
+void add_timing(int pid, double start, char *out) {
+  struct phasetime *this;
+  char *name;
+  int i;
+
+  if (timereport == 0) return;
+  lasttime = __sync_fetch_and_add(Phasecount, 1);
+  if (lasttime >= MAXPHASETIMES) {
+    lasttime = -1; return;
+  }
+  this = Phasetime + lasttime;
+  name = strrchr(cmdarg[0], '/');
+  name = (name == NULL) ? cmdarg[0] : name + 1;
+  snprintf(this->phase, TIMENAMELEN, "%s", name);
+  name = (cmdarg[0] == phasecmd[LINK_PHASE]) ? outname : initname;
+  snprintf(this->file, TIMENAMELEN, "%s", name == NULL ? "" : name);
+  this->pid = pid;
+  this->start = start;
+  this->outbytes = 0;
+
+  // Without a stdout file, use the one after any -o
+  for (i = 1; out == NULL && cmdarg[i] != NULL; i++)
+    if (!strcmp(cmdarg[i], "-o"))
+      out = cmdarg[i + 1];
+  snprintf(this->outname, TIMENAMELEN, "%s", out == NULL ? "" : out);
+}
+
+// Add the size of the named file to our last record
+void note_output(char *name) {
+  struct stat sb;
+
+  if (lasttime == -1) return;
+  if (stat(name, &sb) == 0)
+    Phasetime[lasttime].outbytes += sb.st_size;
+}
+
+// Finish the record for process pid
+// with the resources that it used
+void end_timing(int pid, struct rusage *ru) {
+  struct phasetime *this;
+  int i, count;
+
+  if (timereport == 0) return;
+  count = *Phasecount;
+  if (count > MAXPHASETIMES) count = MAXPHASETIMES;
+  for (i = 0; i < count; i++) {
+    this = Phasetime + i;
+    if (this->pid != pid || this->wall != 0) continue;
+    this->wall = now() - this->start;
+    this->user = ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6;
+    this->sys = ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+    this->maxrss = ru->ru_maxrss;
+    if (this->outname[0] != 0)
+      note_output(this->outname);
+    return;
+  }
+}
+
+// Print out the time report, either as a table
+// or as CSV lines, with the totals for each phase
+void time_report(void) {
+  struct phasetime *this, *that;
+  double wall, user, sys;
+  long maxrss, outbytes;
+  int i, j, count, seen;
+
+  count = *Phasecount;
+  if (count > MAXPHASETIMES) count = MAXPHASETIMES;
+
+  if (timereport == 2)
+    fprintf(stderr, "phase,file,wall_s,user_s,sys_s,maxrss_kb,output_bytes\n");
+  else
+    fprintf(stderr, "%-12s %-20s %8s %8s %8s %10s %12s\n", "Phase", "File",
+	    "Wall(s)", "User(s)", "Sys(s)", "MaxRSS(KB)", "Output(B)");
+
+  for (i = 0; i < count; i++) {
+    this = Phasetime + i;
+    if (timereport == 2)
+      fprintf(stderr, "%s,%s,%.6f,%.6f,%.6f,%ld,%ld\n", this->phase,
+	      this->file, this->wall, this->user, this->sys,
+	      this->maxrss, this->outbytes);
+    else
+      fprintf(stderr, "%-12s %-20s %8.3f %8.3f %8.3f %10ld %12ld\n",
+	      this->phase, this->file, this->wall, this->user, this->sys,
+	      this->maxrss, this->outbytes);
+  }
+
+  // Total up each phase across all the files,
+  // in the order that the phases first appear
+  for (i = 0; i < count; i++) {
+    this = Phasetime + i;
+    for (seen = 0, j = 0; j < i; j++)
+      if (!strcmp(Phasetime[j].phase, this->phase)) seen = 1;
+    if (seen) continue;
+
+    wall = user = sys = 0; maxrss = outbytes = 0;
+    for (j = i; j < count; j++) {
+      that = Phasetime + j;
+      if (strcmp(that->phase, this->phase)) continue;
+      wall += that->wall; user += that->user; sys += that->sys;
+      outbytes += that->outbytes;
+      if (that->maxrss > maxrss) maxrss = that->maxrss;
+    }
+    if (timereport == 2)
+      fprintf(stderr, "%s,TOTAL,%.6f,%.6f,%.6f,%ld,%ld\n", this->phase,
+	      wall, user, sys, maxrss, outbytes);
+    else
+      fprintf(stderr, "%-12s %-20s %8.3f %8.3f %8.3f %10ld %12ld\n",
+	      this->phase, "(total)", wall, user, sys, maxrss, outbytes);
+  }
+}
+#endif
+
+// Print out the command with arguments in cmdarg[]
+void show_command(void) {
+  int i;
+
+  fprintf(stderr, "Doing: ");
+  for (i = 0; cmdarg[i] != NULL; i++) fprintf(stderr, "%s ", cmdarg[i]);
+  fprintf(stderr, "\n");
+#ifdef INPROCESS
+  if (findlinked(cmdarg[0]) != NULL)
+    fprintf(stderr, "  using the linked-in phase\n");
+#endif
+}
+
+// In a child process, run the command
+// with arguments in cmdarg[]
+void exec_command(void) {
+#ifdef INPROCESS
+  struct linkedphase *phase;
+
+  // Call the phase directly if it is linked in. Setting
+  // optind to zero makes glibc's getopt() start afresh
+  phase = findlinked(cmdarg[0]);
+  if (phase != NULL) {
+    optind = 0;
+    exit(phase->main(cmdcount - 1, cmdarg));
+  }
+#endif
+
+  execvp(cmdarg[0], cmdarg);
+  fprintf(stderr, "exec %s failed\n", cmdarg[0]);
+  exit(1);
+}
+
+// Wait for the child process pid. Return 0 if it
+// exited with status zero, 1 if it exited with
+// another status, or 2 if it didn't exit
+int wait_command(int pid) {
+  int wstatus;
+#ifdef TIMEREPORT
+  struct rusage ru;
+
+  if (wait4(pid, &wstatus, 0, &ru) == -1) {
+    fprintf(stderr, "waitpid failed\n");
+    Exit(1);
+  }
+  end_timing(pid, &ru);
+#else
+
+  if (waitpid(pid, &wstatus, 0) == -1) {
+    fprintf(stderr, "waitpid failed\n");
+    Exit(1);
+  }
+#endif
+
+  if (WIFEXITED(wstatus)) {
+    if (WEXITSTATUS(wstatus) != 0) return (1);
+    return (0);
+  }
+  return (2);
+}
+
 // Run the command with arguments in cmdarg[].
 // Replace stdin/stdout by opening in/out as required.
 // If the command doesn't Exit(0), stop.
 void run_command(char *in, char *out) {
-  int i, pid, wstatus;
+  int pid;
   FILE *fh;
+#ifdef TIMEREPORT
+  double start = now();
+#endif
 
   if (verbose) {
-    fprintf(stderr, "Doing: ");
-    for (i = 0; cmdarg[i] != NULL; i++) fprintf(stderr, "%s ", cmdarg[i]);
-    fprintf(stderr, "\n");
+    show_command();
     if (in != NULL) fprintf(stderr, "  redirecting stdin from %s\n", in);
     if (out != NULL) fprintf(stderr, "  redirecting stdout to %s\n", out);
   }
@@ -198,21 +837,19 @@ void run_command(char *in, char *out) {
       }
     }
 
-    execvp(cmdarg[0], cmdarg);
-    fprintf(stderr, "exec %s failed\n", cmdarg[0]);
+    exec_command();
 
     // The parent: wait for child to exit cleanly
   default:
-    if (waitpid(pid, &wstatus, 0) == -1) {
-      fprintf(stderr, "waitpid failed\n");
+#ifdef TIMEREPORT
+    add_timing(pid, start, out);
+#endif
+    // Get the parent to Exit(1) if the
+    // child's Exit status was not zero
+    switch (wait_command(pid)) {
+    case 1:
       Exit(1);
-    }
-
-    // Get the child's Exit status and get the parent
-    // to Exit(1) if the Exit status was not zero
-    if (WIFEXITED(wstatus)) {
-      if (WEXITSTATUS(wstatus) != 0) Exit(1);
-    } else {
+    case 2:
       fprintf(stderr, "child phase didn't exit\n"); Exit(1);
     }
 
@@ -221,43 +858,188 @@ void run_command(char *in, char *out) {
   }
 }
 
-// Pre-process the file using the C pre-processor
-char *do_preprocess(char *name) {
+// Start the command with arguments in cmdarg[]
+// and return its process id. Replace stdin by
+// infd and stdout by outfd if they are not -1.
+// The child closes otherfd, which is the read end
+// of the pipe that outfd writes to. The parent
+// closes infd and outfd once the child has them.
+int start_command(int infd, int outfd, int otherfd) {
+  int pid;
+#ifdef TIMEREPORT
+  double start = now();
+#endif
+
+  if (verbose) {
+    show_command();
+    if (infd != -1) fprintf(stderr, "  reading stdin from a pipe\n");
+    if (outfd != -1) fprintf(stderr, "  writing stdout to a pipe\n");
+  }
+
+  pid = fork();
+  if (pid == -1) {
+    fprintf(stderr, "fork failed\n");
+    Exit(1);
+  }
+
+  // Child process: move the pipes onto stdin/stdout
+  if (pid == 0) {
+    if (infd != -1) {
+      dup2(infd, 0); close(infd);
+    }
+    if (outfd != -1) {
+      dup2(outfd, 1); close(outfd); close(otherfd);
+    }
+    exec_command();
+  }
+
+  // The parent
+#ifdef TIMEREPORT
+  add_timing(pid, start, NULL);
+#endif
+  if (infd != -1) close(infd);
+  if (outfd != -1) close(outfd);
+  return (pid);
+}
+
+// Add the arguments which make the scanner write a make
+// dependency file for the C file. The target is the file
+// which we are making from it: the object or assembly file,
+// or the executable. Without -MF, the dependency file is named
+// after the -o file when there is one, else after the C file
+void add_depargs(void) {
+  char *target, *dname;
+  int len;
+
+  if (last_phase == GEN_PHASE)
+    target = (outname != NULL) ? outname : alter_suffix('s');
+  else if (last_phase == LINK_PHASE)
+    target = (outname != NULL) ? outname : AOUT;
+  else
+    target = (outname != NULL && last_phase == ASM_PHASE) ?
+      outname : alter_suffix('o');
+
+  dname = depname;
+  if (dname == NULL && outname != NULL && last_phase != LINK_PHASE &&
+      last_phase != CPP_PHASE) {
+    dname = (char *) malloc(strlen(outname) + 3);
+    strcpy(dname, outname);
+    len = strlen(dname);
+    if (len > 2 && dname[len - 2] == '.')
+      dname[len - 1] = 'd';
+    else
+      strcat(dname, ".d");
+  }
+  if (dname == NULL)
+    dname = alter_suffix('d');
+
+  add_cmdarg("-MF");
+  add_cmdarg(dname);
+  add_cmdarg("-MT");
+  add_cmdarg(target);
+  if (depphony)
+    add_cmdarg("-MP");
+}
+
+// Build the command to pre-process the file. The
+// scanner has the C pre-processor built in. If tokens
+// is set, it scans the file as well, else it only
+// outputs the pre-processed file
+void build_cppcmd(char *name, int tokens) {
   int i;
-  char *tempname;
 
-  // Build the command
   clear_cmdarg();
-  add_cmdarg(phasecmd[CPP_PHASE]);
+  if (tokens) {
+    add_cmdarg(phasecmd[TOK_PHASE]);
+  } else {
+    add_cmdarg(phasecmd[CPP_PHASE]);
+    add_cmdarg("-E");
+  }
   for (i = 0; cppflags[i] != NULL; i++)
     add_cmdarg(cppflags[i]);
   for (i = 0; i < cppxindex; i++) {
     add_cmdarg("-D");
     add_cmdarg(cppextra[i]);
   }
+  if (makedeps)
+    add_depargs();
   add_cmdarg(name);
   add_cmdarg(NULL);
+}
 
-  // If this is the last phase, use outname
-  // as the output file, or stdout if NULL.
+// Pre-process the file if this is the last phase,
+// with outname as the output file, or stdout if NULL.
+// Otherwise the scanner pre-processes the file itself
+char *do_preprocess(char *name) {
   if (last_phase == CPP_PHASE) {
+    build_cppcmd(name, 0);
     run_command(NULL, outname);
     Exit(0);
   }
+  return (name);
+}
 
-  // Not the last phase, make a temp file
-  tempname = newtempfile(initname, "_cpp");
-  run_command(NULL, tempname);
-  return (tempname);
+// Run the scanner and the parser on the C file at the
+// same time, with a pipe carrying the tokens between
+// them. Stop if either of them fails.
+void do_pipeline(char *name, char *symname, char *astname,
+		 char *symidxname, char *idxname) {
+  int tokparse[2];
+  int pid[2];
+  int i, failed, signalled;
+
+  // Start the scanner writing into the pipe
+  if (pipe(tokparse) == -1) {
+    fprintf(stderr, "pipe failed\n"); Exit(1);
+  }
+  build_cppcmd(name, 1);
+  pid[0] = start_command(-1, tokparse[1], tokparse[0]);
+
+  // Start the parser reading from the pipe
+  clear_cmdarg();
+  add_cmdarg(phasecmd[PARSE_PHASE]);
+  add_cmdarg(symname);
+  add_cmdarg(astname);
+  add_cmdarg(symidxname);
+  add_cmdarg(idxname);
+#ifdef PCHFILES
+  if (pchdir != NULL) add_cmdarg(pchdir);
+#endif
+  add_cmdarg(NULL);
+  pid[1] = start_command(tokparse[0], -1, -1);
+
+  // Wait for both. The scanner, if killed because
+  // the parser stopped reading its output, isn't
+  // the real failure, so only report a phase that
+  // didn't exit if no other phase reported an error.
+  failed = 0; signalled = 0;
+  for (i = 0; i < 2; i++) {
+    switch (wait_command(pid[i])) {
+    case 1: failed = 1; break;
+    case 2: signalled = 1;
+    }
+  }
+  if (failed) Exit(1);
+  if (signalled) {
+    fprintf(stderr, "child phase didn't exit\n"); Exit(1);
+  }
+#ifdef TIMEREPORT
+  // The parser was the last phase started
+  note_output(symname); note_output(astname);
+  note_output(symidxname); note_output(idxname);
+#endif
 }
 
-// Assemble the given filename
-char *do_assemble(char *name) {
+// Assemble the given filename into objname,
+// or choose the object file's name if it is NULL
+char *do_assemble(char *name, char *objname) {
   char *tempname;
 
   // If this is the last phase, use outname if
   // not NULL, or change the original file's suffix
-  if (last_phase == ASM_PHASE) {
+  if (objname != NULL) {
+    tempname = objname;
+  } else if (last_phase == ASM_PHASE) {
     if (outname == NULL)
       outname = alter_suffix('o');
     tempname = outname;
@@ -283,49 +1065,81 @@ char *do_assemble(char *name) {
 }
 
 // Run several compiler phases to take a
-// pre-processed C file to an assembly file
+// C file to an assembly file
 char *do_compile(char *name) {
-  char *tokname, *symname, *astname;
+  char *tokname = NULL, *symname, *astname, *symidxname;
   char *idxname, *qbename, *asmname;
+#ifdef COMPCACHE
+  char *entry;
+#endif
 
-  // We need to run the scanner, the parser
-  // and the code generator. Get a temp filename
-  // for the scanner's output.
-  tokname = newtempfile(initname, "_tok");
-
-  // Build and run the scanner command
-  clear_cmdarg();
-  add_cmdarg(phasecmd[TOK_PHASE]);
-  add_cmdarg(NULL);
-  run_command(name, tokname);
-
-  // Get temp filenames for the parser's output
-  symname = newtempfile(initname, "_sym");
-  astname = newtempfile(initname, "_ast");
-
-  // Build and run the parser command
-  clear_cmdarg();
-  add_cmdarg(phasecmd[PARSE_PHASE]);
-  add_cmdarg(symname);
-  add_cmdarg(astname);
-  add_cmdarg(NULL);
-  run_command(tokname, NULL);
-
-  // Get some temporary filenames even
-  // if we don't use them.
-  idxname = newtempfile(initname, "_idx");
-  qbename = newtempfile(initname, "_qbe");
-  asmname = newtempfile(initname, "_s");
-
-  // If this phase (compile to assembly) is
+  // Get a temporary filename for the assembly
+  // output. If this phase (compile to assembly) is
   // the last, use outname if not NULL,
   // or change the original file's suffix.
+  asmname = newtempfile(initname, "_s");
   if (last_phase == GEN_PHASE) {
     if (outname == NULL)
       outname = alter_suffix('s');
     asmname = outname;
   }
 
+  // Unless it is piped into the parser, run the
+  // scanner, which pre-processes the C file as well.
+  // Get a temp filename for the scanner's output
+  if (pipe_phases == 0) {
+    tokname = newmemfile(initname, "_tok");
+    build_cppcmd(name, 1);
+    run_command(NULL, tokname);
+  }
+
+#ifdef COMPCACHE
+  // Use the cached assembly output if we have it
+  if (cachedir != NULL) {
+    entry = cache_entry(tokname);
+    if (cache_fetch(entry, asmname)) {
+      if (last_phase == GEN_PHASE)
+	Exit(0);
+      return (asmname);
+    }
+  }
+#endif
+
+  // We need to run the parser and the code
+  // generator. Get temp filenames for the
+  // parser's output.
+  symname = newmemfile(initname, "_sym");
+  astname = newmemfile(initname, "_ast");
+  symidxname = newmemfile(initname, "_sdx");
+  idxname = newmemfile(initname, "_idx");
+
+  // When piping, run the scanner
+  // and the parser together
+  if (pipe_phases) {
+    do_pipeline(name, symname, astname, symidxname, idxname);
+  } else {
+    // Build and run the parser command
+    clear_cmdarg();
+    add_cmdarg(phasecmd[PARSE_PHASE]);
+    add_cmdarg(symname);
+    add_cmdarg(astname);
+    add_cmdarg(symidxname);
+    add_cmdarg(idxname);
+#ifdef PCHFILES
+    if (pchdir != NULL) add_cmdarg(pchdir);
+#endif
+    add_cmdarg(NULL);
+    run_command(tokname, NULL);
+#ifdef TIMEREPORT
+    note_output(symname); note_output(astname);
+    note_output(symidxname); note_output(idxname);
+#endif
+  }
+
+  // Get a temporary filename even
+  // if we don't use it.
+  qbename = newmemfile(initname, "_qbe");
+
   // Before we run the code generator, see
   // if the next (QBE or peephole) phase exists.
   // If not, we go straight to assembly code, so
@@ -340,6 +1154,13 @@ char *do_compile(char *name) {
   add_cmdarg(symname);
   add_cmdarg(astname);
   add_cmdarg(idxname);
+  add_cmdarg(symidxname);
+#ifdef COMPCACHE
+#ifdef FUNCCACHE
+  // The code generator caches each function's code there too
+  if (cachedir != NULL) add_cmdarg(cachedir);
+#endif
+#endif
   add_cmdarg(NULL);
   run_command(NULL, qbename);
 
@@ -354,6 +1175,14 @@ char *do_compile(char *name) {
       add_cmdarg(qbename);
     }
     if (cpu== CPU_6809) {
+#ifdef COMPCACHE
+#ifdef FUNCCACHE
+      if (cachedir != NULL) {
+	add_cmdarg("-C");
+	add_cmdarg(cachedir);
+      }
+#endif
+#endif
       add_cmdarg("-o");
       add_cmdarg(asmname);
       add_cmdarg(qbename);
@@ -363,6 +1192,11 @@ char *do_compile(char *name) {
     run_command(NULL, NULL);
   }
 
+#ifdef COMPCACHE
+  if (cachedir != NULL)
+    cache_store(entry, asmname);
+#endif
+
   // Stop now if we are the last phase
   if (last_phase == GEN_PHASE)
     Exit(0);
@@ -397,6 +1231,44 @@ void do_link(void) {
   run_command(NULL, NULL);
 }
 
+// Compile and/or assemble the named file in a new
+// job, once fewer than jobs of them are running.
+// The object file's name is chosen here so that the
+// link order and the temporary files don't depend
+// on the order in which the jobs finish.
+void start_job(char *name) {
+  char *objname;
+  int pid;
+
+  while (running >= jobs)
+    wait_job();
+
+  // Don't start any more jobs after one has failed
+  if (jobfailed) return;
+
+  objname = newtempfile(initname, "_o");
+  addobjname(objname);
+
+  pid = fork();
+  if (pid == -1) {
+    fprintf(stderr, "fork failed\n");
+    Exit(1);
+  }
+
+  // The job has only its own temporary files
+  if (pid == 0) {
+    Tmphead = Tmptail = NULL;
+    running = 0;
+    injob = 1;
+    if (endswith(name, 'c'))
+      do_assemble(do_compile(do_preprocess(name)), objname);
+    else
+      do_assemble(name, objname);
+    Exit(0);
+  }
+  running++;
+}
+
 // Given a CPU/platform name, change the phase
 // programs and object files
 void set_phaseprograms(char *cpuname) {
@@ -423,7 +1295,7 @@ void set_phaseprograms(char *cpuname) {
 
 // Print out a usage if started incorrectly
 static void usage(char *prog) {
-  fprintf(stderr, "Usage: %s [-vcESX] [-D ...] [-m CPU] [-o outfile] file [file ...]\n",
+  fprintf(stderr, "Usage: %s [-vcESXp] [-C dir] [-D ...] [-H dir] [-j N] [-MD] [-MF depfile] [-MP] [-m CPU] [-o outfile] file [file ...]\n",
 	  prog);
   fprintf(stderr,
 	  "       -v give verbose output of the compilation stages\n");
@@ -431,36 +1303,79 @@ static void usage(char *prog) {
   fprintf(stderr, "       -E pre-process the file, output on stdout\n");
   fprintf(stderr, "       -S generate assembly files but don't link them\n");
   fprintf(stderr, "       -X keep temporary files for debugging\n");
+  fprintf(stderr,
+	  "       -p run the scanner and the parser together through a pipe\n");
   fprintf(stderr, "       -D ..., set a pre-processor define\n");
+  fprintf(stderr, "       -MD, also write a make dependency file\n");
+  fprintf(stderr, "       -MF depfile, write it to depfile\n");
+  fprintf(stderr, "       -MP, add a phony target for each header\n");
+  fprintf(stderr, "       -j N, compile up to N files at once when linking\n");
+#ifdef COMPCACHE
+  fprintf(stderr, "       -C dir, cache the assembly output in dir\n");
+#endif
+#ifdef PCHFILES
+  fprintf(stderr, "       -H dir, keep precompiled headers in dir\n");
+#endif
+#ifdef TIMEREPORT
+  fprintf(stderr, "       -ftime-report, print the time and resources each phase used\n");
+  fprintf(stderr, "       -ftime-report=csv, print them as CSV lines\n");
+#endif
   fprintf(stderr, "       -m CPU, set the CPU e.g. -m 6809, -m qbe\n");
   fprintf(stderr, "       -o outfile, produce the outfile executable file\n");
+#ifdef COMPSERVER
+  fprintf(stderr, "   or: %s --server [options] socket\n", prog);
+  fprintf(stderr, "       run as a compile server, used when WCCSERVER names the socket\n");
+#endif
   Exit(1);
 }
 
 
-// Main program: check arguments, or print a usage
-// if we don't have any arguments.
+// Get the options from the command line
+void get_options(int argc, char **argv) {
+  int opt;
 
-int main(int argc, char **argv) {
-  int i, opt;
-
-  phasecmd = qbephasecmd;
-  cppflags = qbecppflags;
-  preobjs = qbepreobjs;
-  postobjs = qbepostobjs;
-
-  // Get the options
-  if (argc < 2)
-    usage(argv[0]);
-  while ((opt = getopt(argc, argv, "vcESXo:m:D:")) != -1) {
+  while ((opt = getopt(argc, argv, "vcESXpj:o:m:C:D:f:H:M:")) != -1) {
     switch (opt) {
     case 'v': verbose = 1; break;
     case 'c': last_phase = ASM_PHASE; break;
     case 'E': last_phase = CPP_PHASE; break;
     case 'S': last_phase = GEN_PHASE; break;
     case 'X': keep_tempfiles = 1; break;
+    case 'p': pipe_phases = 1; break;
+#ifdef TIMEREPORT
+    case 'f': if (!strcmp(optarg, "time-report")) timereport = 1;
+	      else if (!strcmp(optarg, "time-report=csv")) timereport = 2;
+	      else usage(argv[0]);
+	      if (Phasetime == NULL) init_timing();
+	      break;
+#endif
+    case 'j': jobs = atoi(optarg);
+	      if (jobs < 1) usage(argv[0]);
+	      break;
     case 'm': set_phaseprograms(optarg); break;
     case 'o': outname = optarg; break;
+#ifdef PCHFILES
+    case 'H': pchdir = optarg;
+	      mkdir(pchdir, 0777);
+	      break;
+#endif
+#ifdef COMPCACHE
+    case 'C': cachedir = optarg;
+	      mkdir(cachedir, 0777);
+	      break;
+#endif
+    case 'M': if (!strcmp(optarg, "D")) makedeps = 1;
+	      else if (!strcmp(optarg, "P")) depphony = 1;
+	      else if (optarg[0] == 'F') {
+		// Take the name from -MFname or from -MF name
+		makedeps = 1;
+		depname = optarg + 1;
+		if (*depname == 0) {
+		  if (optind >= argc) usage(argv[0]);
+		  depname = argv[optind++];
+		}
+	      } else usage(argv[0]);
+	      break;
     case 'D': if (cppxindex >= MAXCPPEXTRA) {
 		fprintf(stderr, "Too many -D arguments\n"); Exit(1);
 	      }
@@ -468,6 +1383,288 @@ int main(int argc, char **argv) {
     }
   }
 
+#ifdef COMPCACHE
+  // The cache key needs all of the scanner's
+  // output before the parser starts, so don't pipe
+  if (cachedir != NULL)
+    pipe_phases = 0;
+#endif
+}
+
+#ifdef COMPSERVER
+// On the host, "wcc --server [options] socket" runs as a compile
+// server on a Unix domain socket. A wcc started with WCCSERVER set
+// to the socket's name sends it the command line, the working
+// directory, the PATH and its stdin, stdout and stderr, and exits
+// with the status which comes back. Without a server, wcc does the
+// compile itself. The server forks a process for each compile, so
+// the phases linked into it, the 6809 peephole rules which it has
+// read in and the options it was started with, e.g. -C and -H,
+// are all there without any program startup.
+FILE *loadrules(char *name);
+void do_files(int argc, char **argv);
+
+// Read len bytes from fd into buf.
+// Return 1 if we got them all, 0 if not
+int readall(int fd, char *buf, int len) {
+  int n;
+
+  while (len > 0) {
+    n = read(fd, buf, len);
+    if (n == -1 && errno == EINTR) continue;
+    if (n <= 0) return (0);
+    buf += n; len -= n;
+  }
+  return (1);
+}
+
+// Write len bytes from buf to fd.
+// Return 1 if we wrote them all, 0 if not
+int writeall(int fd, char *buf, int len) {
+  int n;
+
+  while (len > 0) {
+    n = write(fd, buf, len);
+    if (n == -1 && errno == EINTR) continue;
+    if (n <= 0) return (0);
+    buf += n; len -= n;
+  }
+  return (1);
+}
+
+// Make a Unix domain socket address for the named socket
+void socket_addr(struct sockaddr_un *addr, char *name) {
+  if (strlen(name) >= sizeof(addr->sun_path)) {
+    fprintf(stderr, "Socket name too long: %s\n", name);
+    Exit(1);
+  }
+  memset(addr, 0, sizeof(struct sockaddr_un));
+  addr->sun_family = AF_UNIX;
+  strcpy(addr->sun_path, name);
+}
+
+// Send the command line to the server on the socket named
+// by WCCSERVER and exit with the status of the compile.
+// Return if we can't connect to the server
+void run_client(int argc, char **argv) {
+  struct sockaddr_un addr;
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  char ctrl[CMSG_SPACE(3 * sizeof(int))];
+  int fds[3] = { 0, 1, 2 };
+  char cwd[4096], *path, *buf, *cptr;
+  int sock, i, len, status;
+
+  sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock == -1) return;
+  socket_addr(&addr, getenv("WCCSERVER"));
+  if (connect(sock, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+    close(sock); return;
+  }
+
+  // The request is the working directory, the PATH
+  // and the arguments, each one NUL-terminated
+  if (getcwd(cwd, sizeof(cwd)) == NULL) {
+    fprintf(stderr, "Unable to get the working directory\n");
+    Exit(1);
+  }
+  path = getenv("PATH");
+  if (path == NULL) path = "";
+  len = strlen(cwd) + strlen(path) + 2;
+  for (i = 0; i < argc; i++)
+    len += strlen(argv[i]) + 1;
+  buf = (char *) malloc(len);
+  strcpy(buf, cwd);
+  cptr = buf + strlen(cwd) + 1;
+  strcpy(cptr, path);
+  cptr += strlen(path) + 1;
+  for (i = 0; i < argc; i++) {
+    strcpy(cptr, argv[i]);
+    cptr += strlen(argv[i]) + 1;
+  }
+
+  // Send the request's length along with our stdin,
+  // stdout and stderr, then the request itself
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = &len;
+  iov.iov_len = sizeof(int);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctrl;
+  msg.msg_controllen = sizeof(ctrl);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+  memcpy(CMSG_DATA(cmsg), fds, 3 * sizeof(int));
+  if (sendmsg(sock, &msg, 0) == -1) {
+    close(sock); free(buf); return;
+  }
+
+  if (!writeall(sock, buf, len) ||
+      !readall(sock, (char *) &status, sizeof(int))) {
+    fprintf(stderr, "Lost the compile server on %s\n", getenv("WCCSERVER"));
+    Exit(1);
+  }
+  exit(status);
+}
+
+// In a child of the server, read the request on conn. Run the
+// compile in a new process with the client's working directory,
+// PATH and files, and send back its exit status
+void serve_request(int conn) {
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  char ctrl[CMSG_SPACE(3 * sizeof(int))];
+  int fds[3];
+  char *buf, *cwd, *path, *cptr, **args;
+  int i, len, nargs, pid, wstatus, status;
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = &len;
+  iov.iov_len = sizeof(int);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctrl;
+  msg.msg_controllen = sizeof(ctrl);
+  if (recvmsg(conn, &msg, 0) != sizeof(int)) exit(1);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int))) exit(1);
+  memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+
+  // Read the request and split it up
+  if (len <= 0) exit(1);
+  buf = (char *) malloc(len);
+  if (buf == NULL || !readall(conn, buf, len) || buf[len - 1] != 0)
+    exit(1);
+  for (nargs = 0, i = 0; i < len; i++)
+    if (buf[i] == 0) nargs++;
+  nargs -= 2;
+  if (nargs < 1) exit(1);
+  args = (char **) malloc((nargs + 1) * sizeof(char *));
+  cwd = buf;
+  path = cwd + strlen(cwd) + 1;
+  cptr = path + strlen(path) + 1;
+  for (i = 0; i < nargs; i++) {
+    args[i] = cptr;
+    cptr += strlen(cptr) + 1;
+  }
+  args[nargs] = NULL;
+
+  pid = fork();
+  if (pid == -1) exit(1);
+  if (pid == 0) {
+    close(conn);
+    for (i = 0; i < 3; i++) {
+      dup2(fds[i], i); close(fds[i]);
+    }
+    if (chdir(cwd) == -1) {
+      fprintf(stderr, "Unable to change to %s\n", cwd);
+      exit(1);
+    }
+    setenv("PATH", path, 1);
+
+#ifdef TIMEREPORT
+    // Each compile gets its own time report records
+    Phasetime = NULL;
+    lasttime = -1;
+    if (timereport)
+      init_timing();
+#endif
+
+    // Our options are added to those which the server started
+    // with. Setting optind to zero makes getopt() start afresh
+    if (nargs < 2)
+      usage(args[0]);
+    optind = 0;
+    get_options(nargs, args);
+    do_files(nargs, args);
+  }
+
+  for (i = 0; i < 3; i++)
+    close(fds[i]);
+  status = 1;
+  if (waitpid(pid, &wstatus, 0) == pid && WIFEXITED(wstatus))
+    status = WEXITSTATUS(wstatus);
+  writeall(conn, (char *) &status, sizeof(int));
+  exit(0);
+}
+
+// Run as a compile server on the socket named after the options,
+// which become the defaults for each compile. Never returns
+void run_server(int argc, char **argv) {
+  struct sockaddr_un addr;
+  FILE *fp;
+  int sock, conn;
+
+  // Get the options between --server and the socket's name
+  argv[1] = argv[0];
+  argc--; argv++;
+  get_options(argc, argv);
+  if (optind != argc - 1)
+    usage(argv[0]);
+
+  // Read in the peephole rules now, so that
+  // each compile's cpeep already has them
+  fp = loadrules(LIB6809DIR "/rules.6809");
+  if (fp != NULL) fclose(fp);
+
+  sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock == -1) {
+    fprintf(stderr, "Unable to make a socket\n");
+    Exit(1);
+  }
+  socket_addr(&addr, argv[optind]);
+  unlink(argv[optind]);
+  if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+      listen(sock, 20) == -1) {
+    fprintf(stderr, "Unable to listen on %s\n", argv[optind]);
+    Exit(1);
+  }
+  if (verbose)
+    fprintf(stderr, "Compile server listening on %s\n", argv[optind]);
+
+  // A client which goes away shouldn't stop us
+  signal(SIGPIPE, SIG_IGN);
+
+  // Serve each request in a child process, and
+  // collect the ones which have finished
+  while (1) {
+    conn = accept(sock, NULL, NULL);
+    if (conn == -1) {
+      if (errno == EINTR) continue;
+      fprintf(stderr, "accept failed\n");
+      Exit(1);
+    }
+    switch (fork()) {
+    case -1:
+      fprintf(stderr, "fork failed\n");
+      break;
+    case 0:
+      close(sock);
+      signal(SIGPIPE, SIG_DFL);
+      serve_request(conn);
+    }
+    close(conn);
+    while (waitpid(-1, NULL, WNOHANG) > 0);
+  }
+}
+#endif
+
+// Compile, assemble and link the files
+// named on the command line after the options
+void do_files(int argc, char **argv) {
+  int i, usejobs;
+
+  // Only use jobs when we are linking, as
+  // otherwise we stop after the first file
+  usejobs = 0;
+  if (jobs > 1 && last_phase == LINK_PHASE)
+    usejobs = 1;
+
   // Now process the filenames after the arguments
   if (optind >= argc) usage(argv[0]);
   for (i = optind; i < argc; i++) {
@@ -475,10 +1672,21 @@ int main(int argc, char **argv) {
 
     if (endswith(argv[i], 'c')) {
       // A C source file, do all major phases
-      addobjname(do_assemble(do_compile(do_preprocess(argv[i]))));
+      if (usejobs) {
+	start_job(argv[i]);
+	continue;
+      }
+      addobjname(do_assemble(do_compile(do_preprocess(argv[i])), NULL));
+#ifdef INPROCESS
+      close_memfiles();
+#endif
     } else if (endswith(argv[i], 's')) {
       // An assembly file, just assemble
-      addobjname(do_assemble(argv[i]));
+      if (usejobs) {
+	start_job(argv[i]);
+	continue;
+      }
+      addobjname(do_assemble(argv[i], NULL));
     } else if (endswith(argv[i], 'o')) {
       // Add object files to the list
       addobjname(argv[i]);
@@ -488,10 +1696,41 @@ int main(int argc, char **argv) {
     }
   }
 
+  // Wait for the jobs to finish, and
+  // stop if any of them failed
+  while (running > 0)
+    wait_job();
+  if (jobfailed)
+    Exit(1);
+
   // Now link all the object files together
   if (outname == NULL) outname = AOUT;
   do_link();
-
   Exit(0);
+}
+
+// Main program: check arguments, or print a usage
+// if we don't have any arguments.
+
+int main(int argc, char **argv) {
+  phasecmd = qbephasecmd;
+  cppflags = qbecppflags;
+  preobjs = qbepreobjs;
+  postobjs = qbepostobjs;
+
+#ifdef COMPSERVER
+  // Run as a compile server, or send the
+  // command line to one if there is one
+  if (argc > 1 && !strcmp(argv[1], "--server"))
+    run_server(argc, argv);
+  if (getenv("WCCSERVER") != NULL)
+    run_client(argc, argv);
+#endif
+
+  // Get the options and do the files
+  if (argc < 2)
+    usage(argv[0]);
+  get_options(argc, argv);
+  do_files(argc, argv);
   return (0);
 }
@@ -7,7 +7,7 @@
 
 // List of phase command strings
 char *qbephasecmd[]= {
-  "cpp",				// C pre-processor
+  BINDIR "/cscan",			// C pre-processor (with -E)
   BINDIR "/cscan",			// Tokeniser
   BINDIR "/cparseqbe",			// Parser
   BINDIR "/cgenqbe",			// Code generator
@@ -16,10 +16,9 @@ char *qbephasecmd[]= {
   "cc"					// Linker
 };
 
-// List of C preprocessor flags
+// List of C preprocessor flags for cscan
 char *qbecppflags[]= {
-  "-nostdinc",
-  "-isystem",
+  "-I",
   INCQBEDIR,
   NULL
 };
@@ -44,7 +43,7 @@ char *qbepostobjs[]= {
 
 // List of phase command strings
 char *phasecmd6809[]= {
-  "cpp",				// C pre-processor
+  BINDIR "/cscan",			// C pre-processor (with -E)
   BINDIR "/cscan",			// Tokeniser
   BINDIR "/cparse6809",			// Parser
   BINDIR "/cgen6809",			// Code generator
@@ -53,10 +52,9 @@ char *phasecmd6809[]= {
   "ld6809"				// Linker
 };
 
-// List of C preprocessor flags
+// List of C preprocessor flags for cscan
 char *cppflags6809[]= {
-  "-nostdinc",
-  "-isystem",
+  "-I",
   INC6809DIR,
   NULL
 };